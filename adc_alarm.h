@@ -0,0 +1,89 @@
+/*****************************************************************************
+* adc_alarm.h
+*
+* Low voltage alarm on filtered ADC values.
+* The alarm is an in-line function evaluated by the ADC ISR on every
+* filtered value, so it works without the receiver polling the sensor.
+* Thresholds are per cell count and in ADC units, converted from voltages
+* at compile time, so the ISR only compares bytes.
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#ifndef __ADC_ALARM_H__
+#define __ADC_ALARM_H__
+
+#include    <stdint.h>
+
+/****************************************************************************
+  Types
+****************************************************************************/
+typedef struct {
+    uint8_t     detect;                 // Lowest value of a rested pack of this cell count
+    uint8_t     on;                     // Alarm turns on at or below
+    uint8_t     off;                    // Alarm turns off at or above
+} adc_alarm_level_t;
+
+typedef struct {
+    uint8_t     level;                  // Detected cell count level + 1, '0'=not detected yet
+    uint8_t     active;                 // Alarm output state
+} adc_alarm_t;
+
+#define     ADC_ALARM_INIT          { 0, 0 }
+
+/* ----------------------------------------------------------------------------
+ * adc_alarm_update()
+ *
+ *  Detect the pack's cell count and evaluate the low voltage alarm.
+ *  The cell count level is the highest level whose 'detect' value the
+ *  filtered voltage reaches, it is detected on the first value and
+ *  re-detected upwards when a larger pack is connected. A level is never
+ *  lowered, so voltage sag under load is not taken for a smaller pack.
+ *  The alarm turns on at or below the level's 'on' value and off at or
+ *  above its 'off' value.
+ *
+ *  param:  alarm state, level table in ascending cell count order,
+ *          number of levels, filtered ADC value
+ *  return: alarm output state, '1'=on
+ *
+ */
+static inline uint8_t adc_alarm_update(adc_alarm_t *alarm, const adc_alarm_level_t *levels,
+                                       uint8_t count, uint8_t value)
+{
+    uint8_t     level;
+
+    for ( level = alarm->level; level < count; level++ )
+    {
+        if ( value < levels[level].detect )
+        {
+            break;
+        }
+    }
+
+    if ( level > alarm->level )
+    {
+        alarm->level = level;
+        alarm->active = 0;
+    }
+
+    if ( alarm->level == 0 )
+    {
+        return 0;
+    }
+
+    level = alarm->level - 1;
+
+    if ( value <= levels[level].on )
+    {
+        alarm->active = 1;
+    }
+    else if ( value >= levels[level].off )
+    {
+        alarm->active = 0;
+    }
+
+    return alarm->active;
+}
+
+#endif  /* __ADC_ALARM_H__ */
@@ -0,0 +1,153 @@
+/*****************************************************************************
+* adc_filter.h
+*
+* ADC readout filters and statistics.
+* The filters are in-line functions so that the ADC ISR and the host
+* benchmark tools (see test/) run exactly the same code.
+* Filter length is passed as a power of 2 'bits' parameter, which is
+* a constant in the firmware and is folded by the compiler.
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#ifndef __ADC_FILTER_H__
+#define __ADC_FILTER_H__
+
+#include    <stdint.h>
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     ADC_FILTER_BOXCAR   0       // Moving average over 2^bits samples
+#define     ADC_FILTER_EMA      1       // Exponential moving average, alpha = 1/2^bits
+
+#define     ADC_AVERAGE_MAX     32      // Longest moving average buffer
+#define     ADC_AVERAGE_MAX_BITS 5
+
+#define     ADC_REST_DECAY      255     // Samples per 1 LSB drop of the rest voltage (~6.7 sec at 38Hz)
+#define     ADC_NEW_PACK        4       // Rise above maximum, in LSB, that marks a new pack
+
+typedef struct {
+    uint8_t     values[ADC_AVERAGE_MAX];
+    uint8_t     index;
+    uint16_t    sum;
+} adc_boxcar_t;
+
+typedef struct {
+    uint16_t    acc;                    // Filter output scaled by 2^bits
+} adc_ema_t;
+
+typedef struct {
+    uint8_t     settle;                 // Samples to skip while the filter settles
+    uint8_t     min;                    // Lowest filtered value
+    uint8_t     max;                    // Highest filtered value
+    uint8_t     rest;                   // Voltage at rest, reference for sag
+    uint8_t     sag;                    // Deepest drop below rest voltage
+    uint8_t     decay;
+} adc_stats_t;
+
+#define     ADC_STATS_INIT(settle)  { (settle), 0xff, 0, 0, 0, 0 }
+
+/* ----------------------------------------------------------------------------
+ * adc_boxcar_update()
+ *
+ *  Moving average of the last 2^bits ADC readouts using a circular buffer.
+ *  The filter state must be zero initialized.
+ *
+ *  param:  filter state, new ADC readout, filter length in bits (1 to 5)
+ *  return: filtered ADC value
+ *
+ */
+static inline uint8_t adc_boxcar_update(adc_boxcar_t *filter, uint8_t readout, uint8_t bits)
+{
+    filter->sum -= filter->values[filter->index];
+    filter->values[filter->index] = readout;
+    filter->sum += readout;
+
+    filter->index++;
+    filter->index &= ((1 << bits) - 1);
+
+    return (uint8_t)(filter->sum >> bits);
+}
+
+/* ----------------------------------------------------------------------------
+ * adc_ema_update()
+ *
+ *  Exponential moving average: y += (x - y) / 2^bits
+ *  Uses 2 bytes of state regardless of length, with a settling time
+ *  of about 2^bits samples per e-fold.
+ *  The filter state must be zero initialized.
+ *
+ *  param:  filter state, new ADC readout, filter length in bits (1 to 5)
+ *  return: filtered ADC value
+ *
+ */
+static inline uint8_t adc_ema_update(adc_ema_t *filter, uint8_t readout, uint8_t bits)
+{
+    filter->acc -= (filter->acc >> bits);
+    filter->acc += readout;
+
+    return (uint8_t)(filter->acc >> bits);
+}
+
+/* ----------------------------------------------------------------------------
+ * adc_stats_update()
+ *
+ *  Track minimum, maximum and deepest sag of filtered ADC values.
+ *  The rest voltage follows the filtered value up immediately and down
+ *  by 1 LSB every ADC_REST_DECAY samples, so the slow discharge of the pack
+ *  is not counted as sag but load sag is. When the voltage returns to rest
+ *  the rest voltage re-arms at the new level.
+ *  The statistics restart when the voltage rises ADC_NEW_PACK above the
+ *  maximum, which happens when a fresh pack is connected.
+ *
+ *  param:  statistics state, filtered ADC value
+ *  return: none
+ *
+ */
+static inline void adc_stats_update(adc_stats_t *stats, uint8_t value)
+{
+    if ( stats->settle )
+    {
+        stats->settle--;
+        return;
+    }
+
+    if ( value > stats->max )
+    {
+        if ( stats->max && value > (stats->max + ADC_NEW_PACK) )
+        {
+            stats->min = value;
+            stats->sag = 0;
+        }
+
+        stats->max = value;
+    }
+
+    if ( value < stats->min )
+    {
+        stats->min = value;
+    }
+
+    if ( value >= stats->rest )
+    {
+        stats->rest = value;
+        stats->decay = 0;
+    }
+    else
+    {
+        if ( (uint8_t)(stats->rest - value) > stats->sag )
+        {
+            stats->sag = stats->rest - value;
+        }
+
+        if ( ++stats->decay == ADC_REST_DECAY )
+        {
+            stats->rest--;
+            stats->decay = 0;
+        }
+    }
+}
+
+#endif  /* __ADC_FILTER_H__ */
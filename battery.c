@@ -0,0 +1,232 @@
+/*****************************************************************************
+* battery.c
+*
+* Battery voltage conversion and remaining capacity estimation.
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#include    <stdint.h>
+
+#include    "battery.h"
+
+/****************************************************************************
+  Globals
+****************************************************************************/
+uint16_t    battery_capacity[BATT_PERCENTS][BATT_SIZES] =
+{
+/* Values are fixed point at 0.01v per LSB
+ *
+ *         3S    4S
+ */
+        {  982, 1309 },    // 0%
+        { 1083, 1443 },    // 5%
+        { 1106, 1475 },    // 10%
+        { 1112, 1483 },    // 15%
+        { 1118, 1491 },    // 20% << discharge danger point
+        { 1124, 1499 },    // 25%
+        { 1130, 1506 },    // 30%
+        { 1136, 1514 },    // 35%
+        { 1139, 1518 },    // 40%
+        { 1145, 1526 },    // 45%
+        { 1151, 1534 },    // 50%
+        { 1156, 1542 },    // 55%
+        { 1162, 1550 },    // 60%
+        { 1174, 1566 },    // 65%
+        { 1186, 1581 },    // 70%
+        { 1195, 1593 },    // 75%
+        { 1207, 1609 },    // 80%
+        { 1225, 1633 },    // 85%
+        { 1233, 1645 },    // 90%
+        { 1245, 1660 },    // 95%
+        { 1260, 1680 },    // 100%
+};
+
+/* ----------------------------------------------------------------------------
+ * battery_voltage()
+ *
+ *  Convert a left adjusted 8-bit ADC readout to battery voltage
+ *  in 0.01v/per LSB units.
+ *  Calculation order is IMPORTANT in order to
+ *  maintain accuracy and stay within 32-bits.
+ *
+ *  param:  ADC readout
+ *  return: battery voltage in 0.01v units
+ *
+ */
+uint16_t battery_voltage(uint16_t adc_value)
+{
+    uint32_t    voltage;
+
+    voltage = adc_value;
+    voltage *= ADC_VREF;
+    voltage *= BATT_DIVIDER;
+    voltage >>= 8;                  // ADC readout scaling
+
+    return (uint16_t) voltage;
+}
+
+/* ----------------------------------------------------------------------------
+ * battery2_voltage()
+ *
+ *  Convert a left adjusted 8-bit ADC readout of the second pack channel
+ *  to battery voltage in 0.01v/per LSB units.
+ *
+ *  param:  ADC readout
+ *  return: battery voltage in 0.01v units
+ *
+ */
+uint16_t battery2_voltage(uint16_t adc_value)
+{
+    uint32_t    voltage;
+
+    voltage = adc_value;
+    voltage *= ADC_VREF;
+    voltage *= BATT2_DIVIDER;
+    voltage >>= 8;                  // ADC readout scaling
+
+    return (uint16_t) voltage;
+}
+
+/* ----------------------------------------------------------------------------
+ * battery_equivalent_voltage()
+ *
+ *  Scale the voltage of a pack with a cell count outside the capacity
+ *  table to the same per cell voltage of a BATT_FIRST_CELLS pack, so the
+ *  table can be used for its percent estimate.
+ *
+ *  param:  battery voltage (fixed point 0.01v per LSB) and cell count
+ *  return: equivalent BATT_FIRST_CELLS pack voltage
+ *
+ */
+uint16_t battery_equivalent_voltage(uint16_t voltage, uint8_t cells)
+{
+    return (uint16_t)(((uint32_t) voltage * BATT_FIRST_CELLS) / cells);
+}
+
+/* ----------------------------------------------------------------------------
+ * battery_size()
+ *
+ *  Determine battery size from its voltage
+ *
+ *  param:  battery voltage (fixed point 0.01v per LSB)
+ *  return: battery capacity table column, or -1 if no match
+ *
+ */
+int battery_size(uint16_t voltage)
+{
+    int         x;
+
+    for ( x = 0; x < BATT_SIZES; x++ )
+    {
+        if ( voltage >= battery_capacity[0][x] &&
+             voltage <= battery_capacity[(BATT_PERCENTS - 1)][x] )
+        {
+            return x;
+        }
+    }
+
+    return -1;
+}
+
+/* ----------------------------------------------------------------------------
+ * battery_cells()
+ *
+ *  Determine battery cell count from its voltage
+ *
+ *  param:  battery voltage (fixed point 0.01v per LSB)
+ *  return: cell count, or 0 if no match
+ *
+ */
+uint8_t battery_cells(uint16_t voltage)
+{
+    int         size;
+
+    size = battery_size(voltage);
+
+    if ( size == -1 )
+    {
+        return 0;
+    }
+
+    return (uint8_t)(size + BATT_FIRST_CELLS);
+}
+
+/* ----------------------------------------------------------------------------
+ * battery_percent()
+ *
+ *  Convert battery voltage (fixed point 0.01v per LSB) to battery percent
+ *  by looking up the capacity table step the voltage falls into.
+ *
+ *  param:  battery voltage
+ *  return: battery percent 0 to 100 in BATT_PERCENT_STEP steps
+ *
+ */
+uint8_t battery_percent(uint16_t voltage)
+{
+    int         x, size;
+
+    size = battery_size(voltage);
+
+    if ( size != -1 )
+    {
+        for ( x = 0; x < (BATT_PERCENTS - 1) ; x++ )
+        {
+            if ( voltage > battery_capacity[x][size] &&
+                 voltage <= battery_capacity[(x + 1)][size] )
+            {
+                return (x * BATT_PERCENT_STEP);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * battery_percent_interpolated()
+ *
+ *  Convert battery voltage (fixed point 0.01v per LSB) to battery percent
+ *  with linear interpolation between capacity table steps.
+ *  A voltage above the table of a battery size reads as 100%.
+ *
+ *  param:  battery voltage
+ *  return: battery percent 0 to 100
+ *
+ */
+uint8_t battery_percent_interpolated(uint16_t voltage)
+{
+    int         x, size;
+    uint16_t    low, high;
+
+    size = battery_size(voltage);
+
+    if ( size == -1 )
+    {
+        for ( x = (BATT_SIZES - 1); x >= 0; x-- )
+        {
+            if ( voltage > battery_capacity[(BATT_PERCENTS - 1)][x] &&
+                 (x == (BATT_SIZES - 1) || voltage < battery_capacity[0][(x + 1)]) )
+            {
+                return 100;
+            }
+        }
+
+        return 0;
+    }
+
+    for ( x = 0; x < (BATT_PERCENTS - 1) ; x++ )
+    {
+        low = battery_capacity[x][size];
+        high = battery_capacity[(x + 1)][size];
+
+        if ( voltage <= high )
+        {
+            return (uint8_t)(x * BATT_PERCENT_STEP +
+                             ((voltage - low) * BATT_PERCENT_STEP + (high - low) / 2) / (high - low));
+        }
+    }
+
+    return 100;
+}
@@ -0,0 +1,71 @@
+/*****************************************************************************
+* battery.h
+*
+* Battery voltage conversion and remaining capacity estimation.
+* This module has no AVR dependencies and is also built into
+* the host benchmark tools (see test/).
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#ifndef __BATTERY_H__
+#define __BATTERY_H__
+
+#include    <stdint.h>
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+/* ADC reference and voltage dividers.
+ * The standard board drives AREF with a 3.3v Zener. Boards that use the
+ * internal temperature sensor (ENABLE_TEMP_SNS in util.h) need the internal
+ * 1.1v reference for all channels, with no Zener on AREF, only a 100nF
+ * capacitor, and dividers sized for the lower reference. The internal
+ * reference varies from 1.0v to 1.2v between devices, measure the AREF pin
+ * and trim BATT_DIVIDER and BATT2_DIVIDER by the reference error.
+ */
+#define     ADC_REF_INTERNAL    0       // Set to non-zero on boards with the internal 1.1v reference
+
+#if ( ADC_REF_INTERNAL )
+#define     ADC_VREF            11      // Internal ADC reference 1.1v
+#define     BATT_DIVIDER        160     // Resistor divider 16:1, up to 17.6v
+#define     BATT2_DIVIDER       90      // Second pack resistor divider 9.0:1, up to 9.9v
+#else
+#define     ADC_VREF            33      // Zener ADC reference 3.3v
+#define     BATT_DIVIDER        57      // Resistor divider 5.7:1
+#define     BATT2_DIVIDER       30      // Second pack resistor divider 3.0:1, up to 9.9v
+#endif
+#define     BATT2_CELLS         2       // Second pack LiPo cell count
+
+/* Battery voltage in 0.01v units to left adjusted 8-bit ADC readout,
+ * the inverse of battery_voltage() for compile time thresholds
+ */
+#define     BATT_ADC(voltage)   ((uint8_t)(((uint32_t)(voltage) * 256UL) / (ADC_VREF * BATT_DIVIDER)))
+
+#define     BATT_2S             0
+#define     BATT_3S             1
+#define     BATT_4S             2
+
+#define     BATT_SIZES          2
+#define     BATT_FIRST_CELLS    3       // Cell count of the first capacity table column
+#define     BATT_PERCENTS       21
+#define     BATT_PERCENT_STEP   5
+
+/****************************************************************************
+  Globals
+****************************************************************************/
+extern uint16_t battery_capacity[BATT_PERCENTS][BATT_SIZES];
+
+/****************************************************************************
+  Function prototypes
+****************************************************************************/
+uint16_t battery_voltage(uint16_t adc_value);
+uint16_t battery2_voltage(uint16_t adc_value);
+uint16_t battery_equivalent_voltage(uint16_t voltage, uint8_t cells);
+int      battery_size(uint16_t voltage);
+uint8_t  battery_cells(uint16_t voltage);
+uint8_t  battery_percent(uint16_t voltage);
+uint8_t  battery_percent_interpolated(uint16_t voltage);
+
+#endif  /* __BATTERY_H__ */
@@ -0,0 +1,104 @@
+/*****************************************************************************
+* board.h
+*
+* Compile time MCU and board profiles.
+* The MCU is selected with the Makefile PROFILE, which sets avr-gcc '-mmcu'
+* and the clock frequency F_CPU. Register mappings, baud rate divisors and
+* timer constants are resolved here by the preprocessor, with no run time cost.
+*
+* Supported:
+*   ATmega88P/PA, ATmega168P/PA, ATmega328P  -- battery sense on ADC0 (PC0), UART0 on PD0/PD1,
+*                                               ISP MOSI/SCK on PB3/PB5
+*   ATmega1284P                              -- battery sense on ADC0 (PA0), UART0 on PD0/PD1,
+*                                               ISP MOSI/SCK on PB5/PB7
+*   All parts: status LED on PB0, calibration jumper on PB1, alarm output on PB2
+*
+* Not supported:
+*   ATtiny84, ATtiny85   -- no USART, the half duplex i.bus needs a software or USI UART
+*   ATtiny4313           -- no ADC
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#ifndef __BOARD_H__
+#define __BOARD_H__
+
+#include    <avr/io.h>
+
+/****************************************************************************
+  MCU register mapping
+****************************************************************************/
+#if defined(__AVR_ATmega88P__) || defined(__AVR_ATmega88PA__) || \
+    defined(__AVR_ATmega168P__) || defined(__AVR_ATmega168PA__) || \
+    defined(__AVR_ATmega328P__)
+
+#define     UART_RX_vect        USART_RX_vect
+#define     HAS_TEMP_SENSOR     1
+#define     ADMUX_REF_1V1       0b11000000  // REFS1:0 internal 1.1v reference
+
+#define     STATUS_LED          0b00000001  // PB0
+#define     CALIBRATION         0b00000010  // PB1
+#define     ALARM_OUT           0b00000100  // PB2, low voltage alarm buzzer or LED (active high)
+#define     PB_ISP_OUT          0b00101000  // PB3 MOSI, PB5 SCK driven low between ISP sessions
+
+#elif defined(__AVR_ATmega1284P__)
+
+#define     UART_RX_vect        USART0_RX_vect
+#define     HAS_TEMP_SENSOR     0
+#define     ADMUX_REF_1V1       0b10000000  // REFS1:0 internal 1.1v reference, '11' selects 2.56v
+
+#define     STATUS_LED          0b00000001  // PB0
+#define     CALIBRATION         0b00000010  // PB1
+#define     ALARM_OUT           0b00000100  // PB2, low voltage alarm buzzer or LED (active high)
+#define     PB_ISP_OUT          0b10100000  // PB5 MOSI, PB7 SCK driven low between ISP sessions
+
+#elif defined(__AVR_ATtiny84__) || defined(__AVR_ATtiny85__)
+#error "ATtiny84/85 have no USART for the i.bus half duplex serial link"
+
+#elif defined(__AVR_ATtiny4313__)
+#error "ATtiny4313 has no ADC for battery voltage sensing"
+
+#else
+#error "MCU not supported, see board.h"
+#endif
+
+/****************************************************************************
+  Clock dependent constants
+****************************************************************************/
+#ifndef F_CPU
+#error "F_CPU not defined"
+#endif
+
+/* Timer0 1mSec time base at Fclk/64 in CTC mode.
+ * A 1mSec period is TMR0_MS_COUNTS plus TMR0_MS_FRACT/64000 Timer0 counts.
+ * The fraction is accumulated, and the period is stretched by one count
+ * when it overflows, 10MHz: 156.25 counts per mSec.
+ */
+#define     TMR0_MS_COUNTS      (F_CPU / 64000UL)
+#define     TMR0_MS_FRACT       (F_CPU % 64000UL)
+
+#if ( TMR0_MS_COUNTS > 255 )
+#error "Device clock too high for Timer0 1mSec time base"
+#endif
+
+/* Timer1 free running at Fclk/8, time stamps and bus gap detection
+ */
+#define     TMR1_GAP_TICKS      (F_CPU / 8000UL)    // 1mSec gap time out
+#define     TIMESTAMP_TO_US(t)  (((uint32_t)(t) * 8000UL) / (F_CPU / 1000UL))
+#define     US_TO_TIMESTAMP(us) (((uint32_t)(us) * (F_CPU / 1000UL)) / 8000UL)
+#define     CYCLES_TO_TIMESTAMP(c)  (((uint32_t)(c) + 7UL) / 8UL)
+
+/* UART divisor with U2X0 set, rounded to nearest, and the
+ * resulting baud rate error in 0.1% units
+ */
+#define     UART_UBRR(baud)     (((F_CPU) + 4UL * (baud)) / (8UL * (baud)) - 1UL)
+#define     UART_ERROR(baud)    ((((F_CPU) / (8UL * (UART_UBRR(baud) + 1UL))) > (baud) ? \
+                                  ((F_CPU) / (8UL * (UART_UBRR(baud) + 1UL))) - (baud) : \
+                                  (baud) - ((F_CPU) / (8UL * (UART_UBRR(baud) + 1UL)))) * 1000UL / (baud))
+
+#if ( UART_ERROR(115200UL) > 25 )
+#warning "Device clock generates 115200 baud with more than 2.5% error"
+#endif
+
+#endif  /* __BOARD_H__ */
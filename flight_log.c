@@ -0,0 +1,422 @@
+/*****************************************************************************
+* flight_log.c
+*
+* Flight data recorder in AVR EEPROM.
+*
+* Samples of the pack voltage, the minimum voltage between samples and the
+* bus error count are delta encoded into a ring buffer that spans the
+* EEPROM. Voltages are logged as filtered 8-bit ADC values, so deltas are
+* exact and the decoder applies the conversion scale stored in the header.
+*
+* Record format, the first byte is a tag:
+*
+*   0b0vvvvsss                  short: 4-bit signed ADC delta, 3-bit sag, no errors
+*   0b10eeeeee dddddddd ssssssss long: 6-bit error count, 8-bit signed ADC delta, 8-bit sag
+*   0b110nnnnn cells interval scale_lo scale_hi adc
+*                               header: flight sequence number 'n', start of a flight
+*   0b11111111                  end of log (erased EEPROM cell)
+*
+* 'sag' is the ADC value of the sample less the minimum ADC value since
+* the previous sample. 'interval' is the sample interval in seconds, and
+* 'scale' converts ADC values to 0.01v units: voltage = (adc * scale) >> 8
+*
+* Wear levelling: records are written around the ring so every cell sees
+* the same number of writes, and the EEPROM directory of flight start
+* addresses is written once per flight. No fixed cell holds a write pointer.
+* The end of the log is found on power up by walking the records of the most
+* recent flight to the end marker.
+*
+* EEPROM writes take ~3.4mSec and are queued. log_service() starts at most
+* one byte write, and is called from a background task in the bus gap
+* so an EEPROM write never delays a bus response.
+* Every record is committed by writing its tag byte last, over the previous
+* end marker, so a power loss never leaves a partial record in the log.
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#include    <stdint.h>
+
+#include    <avr/io.h>
+#include    <avr/eeprom.h>
+
+#include    "util.h"
+#include    "battery.h"
+#include    "flight_log.h"
+
+/****************************************************************************
+  Types
+****************************************************************************/
+typedef struct {
+    uint16_t    address;
+    uint8_t     data;
+} log_write_t;
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     LOG_QUEUE_SIZE      16          // Fits a header record, end marker and directory entry
+#define     LOG_HEADER_SIZE     6
+#define     LOG_LONG_SIZE       3
+#define     LOG_SHORT_SIZE      1
+#define     LOG_RING_SIZE       (LOG_RING_END - LOG_RING_START)
+#define     LOG_INTERVAL        (LOG_INTERVAL_SEC * RATE_1HZ)
+#define     LOG_SCALE           (ADC_VREF * BATT_DIVIDER)
+
+/****************************************************************************
+  Module functions
+****************************************************************************/
+static uint16_t log_advance(uint16_t address, uint8_t count);
+static uint8_t  log_record_size(uint8_t tag);
+static int      log_enqueue_record(uint8_t *record, uint8_t size);
+static void     log_enqueue(uint16_t address, uint8_t data);
+
+/****************************************************************************
+  Globals
+****************************************************************************/
+static log_write_t  log_queue[LOG_QUEUE_SIZE];
+static uint8_t      log_queue_in = 0;
+static uint8_t      log_queue_out = 0;
+static uint8_t      log_queue_count = 0;
+
+static uint16_t     log_head = LOG_RING_START;  // Address of the end marker
+static uint8_t      log_seq = 0;                // Sequence number of the next flight
+static uint8_t      log_active = 0;
+static uint8_t      log_last;                   // Last logged ADC value
+static uint8_t      log_min;                    // Minimum ADC value since last sample
+static uint8_t      log_errors = 0;             // Bus errors since last sample
+static uint32_t     log_time_mark;
+
+/* ----------------------------------------------------------------------------
+ * log_init()
+ *
+ *  Find the end of the log in EEPROM. Call once on power up.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void log_init(void)
+{
+    uint8_t     slot, other, seq, tag, size, newest = 0xff;
+    uint8_t     entry[LOG_DIR_ENTRIES][LOG_DIR_ENTRY_SIZE];
+    uint8_t     valid = 0;
+    uint16_t    address, travelled;
+
+    /* Read the flight directory, and find the most recent flight
+     * which is a valid entry that has no valid successor.
+     */
+    for ( slot = 0; slot < LOG_DIR_ENTRIES; slot++ )
+    {
+        for ( other = 0; other < LOG_DIR_ENTRY_SIZE; other++ )
+        {
+            entry[slot][other] = eeprom_read_byte((uint8_t *)(LOG_DIR_START + slot * LOG_DIR_ENTRY_SIZE + other));
+        }
+
+        address = entry[slot][0] + (entry[slot][1] << 8);
+        seq = entry[slot][2];
+
+        if ( entry[slot][3] == (entry[slot][0] ^ entry[slot][1] ^ seq ^ LOG_DIR_CHECK) &&
+             address >= LOG_RING_START && address < LOG_RING_END &&
+             eeprom_read_byte((uint8_t *) address) == (LOG_TAG_HEADER | seq) )
+        {
+            valid |= (1 << slot);
+        }
+    }
+
+    for ( slot = 0; slot < LOG_DIR_ENTRIES && newest == 0xff; slot++ )
+    {
+        if ( !(valid & (1 << slot)) )
+            continue;
+
+        newest = slot;
+        seq = (entry[slot][2] + 1) & LOG_SEQ_MASK;
+
+        for ( other = 0; other < LOG_DIR_ENTRIES; other++ )
+        {
+            if ( (valid & (1 << other)) && entry[other][2] == seq )
+            {
+                newest = 0xff;
+                break;
+            }
+        }
+    }
+
+    if ( newest == 0xff )
+    {
+        return;
+    }
+
+    /* Walk the records of the most recent flight to the end marker
+     */
+    log_seq = (entry[newest][2] + 1) & LOG_SEQ_MASK;
+    address = entry[newest][0] + (entry[newest][1] << 8);
+    size = LOG_HEADER_SIZE;
+
+    for ( travelled = 0; travelled < LOG_RING_SIZE; travelled += size )
+    {
+        address = log_advance(address, size);
+        tag = eeprom_read_byte((uint8_t *) address);
+
+        if ( (tag & 0xe0) == LOG_TAG_HEADER )
+            break;
+
+        if ( (size = log_record_size(tag)) == 0 )
+            break;
+    }
+
+    log_head = address;
+}
+
+/* ----------------------------------------------------------------------------
+ * log_start()
+ *
+ *  Start logging a new flight.
+ *  The flight does not start when the write queue has no room for
+ *  the header and directory entry, call again on a later pass.
+ *
+ *  param:  battery cell count (0 if unknown), and filtered ADC value
+ *  return: '1' flight started, '0' write queue full
+ *
+ */
+int log_start(uint8_t cells, uint8_t adc_value)
+{
+    uint8_t     header[LOG_HEADER_SIZE];
+    uint16_t    address;
+    uint16_t    directory;
+
+    header[0] = LOG_TAG_HEADER | log_seq;
+    header[1] = cells;
+    header[2] = LOG_INTERVAL_SEC;
+    header[3] = (uint8_t)(LOG_SCALE & 0xff);
+    header[4] = (uint8_t)(LOG_SCALE >> 8);
+    header[5] = adc_value;
+
+    if ( (log_queue_count + LOG_HEADER_SIZE + 1 + LOG_DIR_ENTRY_SIZE) > LOG_QUEUE_SIZE )
+    {
+        return 0;
+    }
+
+    address = log_head;
+    log_enqueue_record(header, LOG_HEADER_SIZE);
+
+    /* Directory entry is written after the header is committed
+     */
+    directory = LOG_DIR_START + (log_seq & (LOG_DIR_ENTRIES - 1)) * LOG_DIR_ENTRY_SIZE;
+    log_enqueue(directory, (uint8_t)(address & 0xff));
+    log_enqueue(directory + 1, (uint8_t)(address >> 8));
+    log_enqueue(directory + 2, log_seq);
+    log_enqueue(directory + 3, (uint8_t)(address & 0xff) ^ (uint8_t)(address >> 8) ^ log_seq ^ LOG_DIR_CHECK);
+
+    log_seq = (log_seq + 1) & LOG_SEQ_MASK;
+    log_last = adc_value;
+    log_min = adc_value;
+    log_errors = 0;
+    log_time_mark = get_global_time();
+    log_active = 1;
+
+    return 1;
+}
+
+/* ----------------------------------------------------------------------------
+ * log_update()
+ *
+ *  Track the minimum voltage and queue a log record every LOG_INTERVAL_SEC.
+ *
+ *  param:  filtered ADC value
+ *  return: none
+ *
+ */
+void log_update(uint8_t adc_value)
+{
+    uint8_t     record[LOG_LONG_SIZE];
+    int16_t     delta;
+    uint8_t     sag;
+
+    if ( !log_active )
+    {
+        return;
+    }
+
+    if ( adc_value < log_min )
+    {
+        log_min = adc_value;
+    }
+
+    if ( (get_global_time() - log_time_mark) < LOG_INTERVAL )
+    {
+        return;
+    }
+
+    delta = (int16_t) adc_value - log_last;
+    sag = adc_value - log_min;
+
+    if ( log_errors == 0 && delta >= -8 && delta <= 7 && sag <= 7 )
+    {
+        record[0] = LOG_TAG_SHORT | ((delta & 0x0f) << 3) | sag;
+
+        if ( !log_enqueue_record(record, LOG_SHORT_SIZE) )
+            return;
+    }
+    else
+    {
+        if ( delta > 127 )
+            delta = 127;
+        else if ( delta < -128 )
+            delta = -128;
+
+        record[0] = LOG_TAG_LONG | (log_errors > 63 ? 63 : log_errors);
+        record[1] = (uint8_t) delta;
+        record[2] = sag;
+
+        if ( !log_enqueue_record(record, LOG_LONG_SIZE) )
+            return;
+
+        log_errors -= (record[0] & 0x3f);
+    }
+
+    log_last += delta;
+    log_min = adc_value;
+    log_time_mark += LOG_INTERVAL;
+}
+
+/* ----------------------------------------------------------------------------
+ * log_count_error()
+ *
+ *  Count a bus error for the next log record.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void log_count_error(void)
+{
+    if ( log_errors < 255 )
+    {
+        log_errors++;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * log_service()
+ *
+ *  Start the next queued EEPROM byte write, if the EEPROM is not busy.
+ *  Call only in the bus gap.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void log_service(void)
+{
+    if ( log_queue_count == 0 || !eeprom_is_ready() )
+    {
+        return;
+    }
+
+    eeprom_update_byte((uint8_t *) log_queue[log_queue_out].address, log_queue[log_queue_out].data);
+
+    log_queue_out++;
+    log_queue_out &= (LOG_QUEUE_SIZE - 1);
+    log_queue_count--;
+}
+
+/* ----------------------------------------------------------------------------
+ * log_advance()
+ *
+ *  Advance an address around the ring buffer.
+ *
+ *  param:  ring buffer address and byte count
+ *  return: new address
+ *
+ */
+static uint16_t log_advance(uint16_t address, uint8_t count)
+{
+    address += count;
+
+    if ( address >= LOG_RING_END )
+    {
+        address -= LOG_RING_SIZE;
+    }
+
+    return address;
+}
+
+/* ----------------------------------------------------------------------------
+ * log_record_size()
+ *
+ *  param:  record tag byte
+ *  return: record size in bytes, 0 for end of log or an invalid tag
+ *
+ */
+static uint8_t log_record_size(uint8_t tag)
+{
+    if ( (tag & 0x80) == LOG_TAG_SHORT )
+        return LOG_SHORT_SIZE;
+
+    if ( (tag & 0xc0) == LOG_TAG_LONG )
+        return LOG_LONG_SIZE;
+
+    if ( (tag & 0xe0) == LOG_TAG_HEADER )
+        return LOG_HEADER_SIZE;
+
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * log_enqueue_record()
+ *
+ *  Queue a record at the end of the log. The new end marker is written
+ *  first and the tag byte last, which commits the record.
+ *
+ *  param:  record bytes and size
+ *  return: '1' record queued, '0' no room in the write queue
+ *
+ */
+static int log_enqueue_record(uint8_t *record, uint8_t size)
+{
+    uint8_t     i;
+
+    if ( (log_queue_count + size + 1) > LOG_QUEUE_SIZE )
+    {
+        return 0;
+    }
+
+    log_enqueue(log_advance(log_head, size), LOG_TAG_END);
+
+    for ( i = 1; i < size; i++ )
+    {
+        log_enqueue(log_advance(log_head, i), record[i]);
+    }
+
+    log_enqueue(log_head, record[0]);
+
+    log_head = log_advance(log_head, size);
+
+    return 1;
+}
+
+/* ----------------------------------------------------------------------------
+ * log_enqueue()
+ *
+ *  Queue one EEPROM byte write.
+ *
+ *  param:  EEPROM address and data byte
+ *  return: none
+ *
+ */
+static void log_enqueue(uint16_t address, uint8_t data)
+{
+    if ( log_queue_count == LOG_QUEUE_SIZE )
+    {
+        return;
+    }
+
+    log_queue[log_queue_in].address = address;
+    log_queue[log_queue_in].data = data;
+
+    log_queue_in++;
+    log_queue_in &= (LOG_QUEUE_SIZE - 1);
+    log_queue_count++;
+}
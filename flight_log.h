@@ -0,0 +1,51 @@
+/*****************************************************************************
+* flight_log.h
+*
+* Flight data recorder in AVR EEPROM
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#ifndef __FLIGHT_LOG_H__
+#define __FLIGHT_LOG_H__
+
+#include    <stdint.h>
+
+#include    "util.h"
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     LOG_INTERVAL_SEC    2           // Seconds between log samples, 1 to 255
+
+/* EEPROM layout
+ * A directory of the most recent flights followed by a ring buffer of records,
+ * the reset cause counters (util.h) take the last bytes of the EEPROM.
+ * See flight_log.c for the record format, and test/logdecode.py for the decoder.
+ */
+#define     LOG_DIR_START       0
+#define     LOG_DIR_ENTRIES     8           // Power of 2
+#define     LOG_DIR_ENTRY_SIZE  4           // Header address (2 bytes), sequence, check byte
+#define     LOG_RING_START      (LOG_DIR_START + LOG_DIR_ENTRIES * LOG_DIR_ENTRY_SIZE)
+#define     LOG_RING_END        RESET_COUNT_START
+
+/* Record tags
+ */
+#define     LOG_TAG_SHORT       0x00        // 0b0vvvvsss, 1 byte
+#define     LOG_TAG_LONG        0x80        // 0b10eeeeee, 3 bytes
+#define     LOG_TAG_HEADER      0xc0        // 0b110nnnnn, 6 bytes
+#define     LOG_TAG_END         0xff        // Erased cell, end of log
+#define     LOG_SEQ_MASK        0x1f
+#define     LOG_DIR_CHECK       0xa5
+
+/****************************************************************************
+  Function prototypes
+****************************************************************************/
+void    log_init(void);
+int     log_start(uint8_t cells, uint8_t adc_value);
+void    log_update(uint8_t adc_value);
+void    log_count_error(void);
+void    log_service(void);
+
+#endif  /* __FLIGHT_LOG_H__ */
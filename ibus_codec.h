@@ -0,0 +1,212 @@
+/*****************************************************************************
+* ibus_codec.h
+*
+* Header-only i.BUS frame codec, shared by the sensor firmware (avr-gcc)
+* and the host test tools.
+*
+* Frame format:
+*
+*   length, command << 4 | sensor ID, 0 to 4 data bytes, checksum low, checksum high
+*
+* 'length' counts all bytes of the frame, and the checksum is 0xffff less
+* the sum of all bytes before it.
+*
+* Constant frames are built with the IBUS_FRAME_*() initializer macros,
+* their checksum is evaluated by the compiler. Frames are encoded in place
+* in a caller buffer: write the data at ibus_frame_payload() and complete
+* the frame with ibus_frame_finish(). The streaming decoder is fed one
+* byte at a time, and holds the frame until the next byte is fed.
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#ifndef __IBUS_CODEC_H__
+#define __IBUS_CODEC_H__
+
+#include    <stdint.h>
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     IBUS_CMD_DISCOVER       8
+#define     IBUS_CMD_SENSOR_TYPE    9
+#define     IBUS_CMD_SENSOR_READ   10
+
+#define     IBUS_FRAME_OVERHEAD     4           // Length, command, 2 checksum bytes
+#ifndef     IBUS_FRAME_MAX
+#define     IBUS_FRAME_MAX          8           // Longest frame, 4 data bytes
+#endif
+
+#define     IBUS_DECODE_MORE        0
+#define     IBUS_DECODE_FRAME       1
+#define     IBUS_DECODE_ERROR      -1
+
+/* Compile time frame construction
+ */
+#define     IBUS_CMD_BYTE(cmd, id)      ((uint8_t)(((cmd) << 4) | ((id) & 0x0f)))
+#define     IBUS_CHECKSUM(sum)          ((uint16_t)(0xffffU - (uint16_t)(sum)))
+#define     IBUS_CHECKSUM_LO(sum)       ((uint8_t)(IBUS_CHECKSUM(sum) & 0xff))
+#define     IBUS_CHECKSUM_HI(sum)       ((uint8_t)(IBUS_CHECKSUM(sum) >> 8))
+
+#define     IBUS_FRAME_CMD(cmd, id) \
+                { 4, IBUS_CMD_BYTE(cmd, id), \
+                  IBUS_CHECKSUM_LO(4 + IBUS_CMD_BYTE(cmd, id)), \
+                  IBUS_CHECKSUM_HI(4 + IBUS_CMD_BYTE(cmd, id)) }
+
+#define     IBUS_FRAME_U16(cmd, id, value) \
+                { 6, IBUS_CMD_BYTE(cmd, id), \
+                  (uint8_t)((value) & 0xff), (uint8_t)((value) >> 8), \
+                  IBUS_CHECKSUM_LO(6 + IBUS_CMD_BYTE(cmd, id) + ((value) & 0xff) + ((value) >> 8)), \
+                  IBUS_CHECKSUM_HI(6 + IBUS_CMD_BYTE(cmd, id) + ((value) & 0xff) + ((value) >> 8)) }
+
+/****************************************************************************
+  Types
+****************************************************************************/
+typedef struct {
+    uint8_t     frame[IBUS_FRAME_MAX];
+    uint8_t     index;                          // Next byte position, '0'=waiting for length
+    uint16_t    sum;
+} ibus_decoder_t;
+
+/* ----------------------------------------------------------------------------
+ * Frame field access
+ *
+ */
+static inline uint8_t ibus_frame_length(const uint8_t *frame)
+{
+    return frame[0];
+}
+
+static inline uint8_t ibus_frame_cmd(const uint8_t *frame)
+{
+    return (frame[1] >> 4);
+}
+
+static inline uint8_t ibus_frame_id(const uint8_t *frame)
+{
+    return (frame[1] & 0x0f);
+}
+
+static inline uint8_t *ibus_frame_payload(uint8_t *frame)
+{
+    return (frame + 2);
+}
+
+/* ----------------------------------------------------------------------------
+ * ibus_frame_finish()
+ *
+ *  Complete a frame in place, the data bytes are already
+ *  in the frame at ibus_frame_payload().
+ *
+ *  param:  frame buffer, command, sensor ID and data byte count
+ *  return: frame length
+ *
+ */
+static inline uint8_t ibus_frame_finish(uint8_t *frame, uint8_t cmd, uint8_t id, uint8_t count)
+{
+    uint8_t     i, length;
+    uint16_t    sum;
+
+    length = count + IBUS_FRAME_OVERHEAD;
+    frame[0] = length;
+    frame[1] = IBUS_CMD_BYTE(cmd, id);
+
+    sum = 0;
+    for ( i = 0; i < count + 2; i++ )
+    {
+        sum += frame[i];
+    }
+
+    frame[i] = IBUS_CHECKSUM_LO(sum);
+    frame[i + 1] = IBUS_CHECKSUM_HI(sum);
+
+    return length;
+}
+
+/* ----------------------------------------------------------------------------
+ * ibus_frame_encode_u16()
+ *
+ *  Encode a frame with a 2-byte data value.
+ *
+ *  param:  frame buffer, command, sensor ID and data value
+ *  return: frame length
+ *
+ */
+static inline uint8_t ibus_frame_encode_u16(uint8_t *frame, uint8_t cmd, uint8_t id, uint16_t value)
+{
+    frame[2] = (uint8_t)(value & 0xff);
+    frame[3] = (uint8_t)(value >> 8);
+
+    return ibus_frame_finish(frame, cmd, id, 2);
+}
+
+/* ----------------------------------------------------------------------------
+ * ibus_decoder_reset()
+ *
+ *  Start decoding at a frame boundary.
+ *
+ *  param:  decoder state
+ *  return: none
+ *
+ */
+static inline void ibus_decoder_reset(ibus_decoder_t *decoder)
+{
+    decoder->index = 0;
+    decoder->sum = 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * ibus_decode_byte()
+ *
+ *  Feed one received byte to the streaming decoder.
+ *  A length byte out of range is rejected and the next byte is taken
+ *  as a length byte. After a frame or a checksum error the decoder
+ *  starts a new frame.
+ *
+ *  param:  decoder state and received byte
+ *  return: IBUS_DECODE_FRAME=complete frame in decoder->frame,
+ *          IBUS_DECODE_MORE=frame incomplete, IBUS_DECODE_ERROR=bad length or checksum
+ *
+ */
+static inline int8_t ibus_decode_byte(ibus_decoder_t *decoder, uint8_t byte)
+{
+    uint8_t     index, length;
+    uint16_t    sum, checksum;
+
+    index = decoder->index;
+
+    if ( index == 0 && (byte < IBUS_FRAME_OVERHEAD || byte > IBUS_FRAME_MAX) )
+    {
+        return IBUS_DECODE_ERROR;
+    }
+
+    decoder->frame[index++] = byte;
+    length = decoder->frame[0];
+
+    if ( index <= (uint8_t)(length - 2) )
+    {
+        decoder->sum += byte;
+        decoder->index = index;
+        return IBUS_DECODE_MORE;
+    }
+
+    if ( index < length )
+    {
+        decoder->index = index;
+        return IBUS_DECODE_MORE;
+    }
+
+    sum = decoder->sum;
+    checksum = decoder->frame[length - 2] | (decoder->frame[length - 1] << 8);
+    ibus_decoder_reset(decoder);
+
+    if ( (uint16_t)(checksum + sum) != 0xffff )
+    {
+        return IBUS_DECODE_ERROR;
+    }
+
+    return IBUS_DECODE_FRAME;
+}
+
+#endif  /* __IBUS_CODEC_H__ */
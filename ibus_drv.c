@@ -13,6 +13,7 @@
 
 #include    <avr/io.h>
 #include    <avr/interrupt.h>
+#include    <util/atomic.h>
 
 #include    "util.h"
 #include    "ibus_drv.h"
@@ -24,105 +25,233 @@
 /****************************************************************************
   Definitions
 ****************************************************************************/
-#define     IBUS_MAX_PACKET_SIZE    8
-#define     IBUS_RCV_PACKET_SIZE    4
-#define     IBUS_BASE_PACKET_SIZE   4
+#define     IBUS_POLL_MIN_TICKS     ((uint16_t) US_TO_TIMESTAMP(IBUS_POLL_MIN_US))
+#define     IBUS_POLL_MAX_TICKS     ((uint16_t) US_TO_TIMESTAMP(IBUS_POLL_MAX_US))
 
 /****************************************************************************
   Globals
 ****************************************************************************/
-uint8_t     packet_buffer[IBUS_MAX_PACKET_SIZE];
-volatile    int inIndex = 0;
-volatile    int isGap = 0;
+uint8_t     packet_buffer[IBUS_FRAME_MAX];  // Transmit frame
+ibus_decoder_t decoder;                     // Receive frame decoder, used by the UART ISR
+volatile    int8_t rxResult = IBUS_READ_RETRY;  // Last received command frame result
+volatile    uint8_t rxCommand;              // Command byte of the last received command frame
+volatile    uint8_t rxDiscard = 0;          // Discard bytes after an error until the next gap
+volatile    int isGap = 1;                  // Bus is idle on power up
+volatile    uint16_t packetStart = 0;       // Time stamp of the first byte of the last packet
+volatile    uint16_t packetHalted = 0;      // Halted Timer1 ticks at the start of the last packet
+volatile    uint16_t pollTicks = 0;         // Measured poll interval, '0'=no poll expected
+uint32_t    packetTime = 0;                 // mSec time of the last valid packet
+uint16_t    resyncCount = 0;                // UART resyncs after bus silence
+uint8_t     resyncArmed = 0;                // Valid traffic since the last counted resync
 
 /****************************************************************************
   Module functions
 ****************************************************************************/
 static void uart_tx_data(uint8_t *, uint8_t);
+static void ibus_send_frame(uint8_t length);
 static void uart_rx_on(void);
 static void uart_rx_off(void);
+static void ibus_resync(void);
 
 /* ---------------------------------------------------------------------------
  * ibus_get_packet()
  *
- * Read packet from serial bus and return command and sensor ID
+ * Read packet from serial bus and return command and sensor ID.
+ * The function does not block, it returns IBUS_READ_RETRY until a
+ * command packet was decoded by the UART receive ISR. The gap watch-dog
+ * timer will help align packet bytes.
  *
  * Param:  pointer to received command and received sensor ID
- * Return: '-1'=packet ok, '0'=bad checksum
+ * Return: '-1'=packet ok, '0'=bad checksum, '-2'=no packet yet
  *
  */
 int ibus_get_packet(uint8_t *ibus_cmd, uint8_t *ibus_sensor_id)
 {
-    uint16_t    packet_checksum;
-    uint16_t    checksum = 65535;
+    int8_t      result;
+    uint8_t     command;
 
-    /* Wait for a full 4-byte data packet from the RC receiver.
-     * The gap watch-dog timer will help align packet bytes.
-     */
-    inIndex = 0;
-
-    while ( inIndex < IBUS_RCV_PACKET_SIZE )
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        /* Do nothing */
+        result = rxResult;
+        command = rxCommand;
+        rxResult = IBUS_READ_RETRY;
     }
 
-    /* Compare checksum against packet
-     * fail if not the same
-     */
-    checksum -= packet_buffer[0];
-    checksum -= packet_buffer[1];
-    packet_checksum = packet_buffer[2] + (packet_buffer[3] << 8);
-
-    if ( checksum != packet_checksum )
+    if ( result != IBUS_PACKET_OK )
     {
-        return IBUS_CHECKSUM_ERR;
+        return result;
     }
 
+    packetTime = get_global_time();
+    resyncArmed = 1;
+
     /* Collect packet command parameters
      */
-    *ibus_cmd = (packet_buffer[1] >> 4) & 0x0f;
-    *ibus_sensor_id = packet_buffer[1] & 0x0f;
+    *ibus_cmd = command >> 4;
+    *ibus_sensor_id = command & 0x0f;
 
     return IBUS_PACKET_OK;
 }
 
 /* ---------------------------------------------------------------------------
- * ibus_send_packet()
+ * ibus_bus_idle()
  *
- * Build and send an iBus packet to the RC receiver.
+ * Report if the bus is in the quiet gap between packets.
+ * The gap is detected by the gap watch-dog timer 1mSec after the last
+ * received byte, and ends with the first byte of the next packet.
  *
- * Param:  pointer to packet content structure and data byte count
- * Return: nothing
+ * Param:  none
+ * Return: '1'=bus is idle, '0'=packet bytes are being received
  *
  */
-void ibus_send_packet(ibus_packet_t *packet, int data_count)
+int ibus_bus_idle(void)
 {
-    int         i, s;
-    uint16_t    checksum;
+    return isGap;
+}
 
-    /* Build packet buffer from input parameters
-     */
-    checksum = (packet->ibus_cmd << 4) + (packet->ibus_sense_id & 0x0f);
-    packet_buffer[1] = checksum;
+/* ---------------------------------------------------------------------------
+ * ibus_time_to_poll()
+ *
+ * Estimate the time left until the next receiver poll from the start
+ * time of the last packet and the measured poll interval.
+ * Timer1 is halted during ADC conversions while the receiver keeps
+ * polling, the halted ticks since the packet start are added to the
+ * elapsed time.
+ * A poll that is overdue by more than a full interval means the bus
+ * went silent, and the estimate is dropped until polling resumes.
+ *
+ * Param:  none
+ * Return: Timer1 time stamp ticks until the next poll, '0'=poll is due,
+ *         IBUS_POLL_NONE=no poll expected
+ *
+ */
+uint16_t ibus_time_to_poll(void)
+{
+    uint16_t    elapsed, interval;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        elapsed = (TCNT1 - packetStart) + (get_timestamp_halted() - packetHalted);
+        interval = pollTicks;
+
+        if ( interval && elapsed >= (uint16_t)(2 * interval) )
+        {
+            pollTicks = 0;
+            interval = 0;
+        }
+    }
 
-    for ( i = 0; i < data_count; i++ )
+    if ( interval == 0 )
     {
-        packet_buffer[2 + i] = packet->data[i];
-        checksum += packet->data[i];
+        return IBUS_POLL_NONE;
     }
 
-    s = IBUS_BASE_PACKET_SIZE + data_count;
-    packet_buffer[0] = s;
-    checksum += s;
+    if ( elapsed >= interval )
+    {
+        return 0;
+    }
 
-    checksum = 65535 - checksum;
-    packet_buffer[2 + i] = (uint8_t)(checksum & 0x00ff);
-    packet_buffer[3 + i] = (uint8_t)(checksum >> 8);
+    return (interval - elapsed);
+}
 
-    /* Transmit packet
-     */
+/* ---------------------------------------------------------------------------
+ * ibus_check_silence()
+ *
+ * Bus silence detector. If no valid packet was received for IBUS_SILENCE_MS
+ * the UART and the packet framing state are reset, and the check restarts.
+ * This recovers from a stuck gap detector, lost framing or a UART error
+ * state without a reboot. Call from the main loop.
+ * While the bus stays silent, for example with the receiver off, in bind
+ * or in failsafe, the resync repeats every IBUS_SILENCE_MS but only the
+ * first one after valid traffic is counted, so the count reflects bus
+ * disturbances and not silence time.
+ *
+ * Param:  none
+ * Return: '1'=bus was resynchronized, '0'=no action
+ *
+ */
+int ibus_check_silence(void)
+{
+    uint32_t    now;
+
+    now = get_global_time();
+
+    if ( (now - packetTime) < IBUS_SILENCE_MS )
+    {
+        return 0;
+    }
+
+    packetTime = now;
+    ibus_resync();
+
+    if ( resyncArmed && resyncCount < 0xffff )
+    {
+        resyncCount++;
+    }
+
+    resyncArmed = 0;
+
+    return 1;
+}
+
+/* ---------------------------------------------------------------------------
+ * ibus_resync_count()
+ *
+ * Return the number of bus silence resyncs since power up,
+ * one per silence that followed valid traffic.
+ *
+ * Param:  none
+ * Return: resync count
+ *
+ */
+uint16_t ibus_resync_count(void)
+{
+    return resyncCount;
+}
+
+/* ---------------------------------------------------------------------------
+ * ibus_send_ack()
+ *
+ * Send an iBus packet without data to the RC receiver,
+ * the response to a discover command.
+ *
+ * Param:  command and sensor ID
+ * Return: nothing
+ *
+ */
+void ibus_send_ack(uint8_t ibus_cmd, uint8_t ibus_sensor_id)
+{
+    ibus_send_frame(ibus_frame_finish(packet_buffer, ibus_cmd, ibus_sensor_id, 0));
+}
+
+/* ---------------------------------------------------------------------------
+ * ibus_send_u16()
+ *
+ * Send an iBus packet with a 2-byte data value to the RC receiver.
+ * The frame is encoded directly in the transmit buffer.
+ *
+ * Param:  command, sensor ID and data value, low byte sent first
+ * Return: nothing
+ *
+ */
+void ibus_send_u16(uint8_t ibus_cmd, uint8_t ibus_sensor_id, uint16_t value)
+{
+    ibus_send_frame(ibus_frame_encode_u16(packet_buffer, ibus_cmd, ibus_sensor_id, value));
+}
+
+/* ---------------------------------------------------------------------------
+ * ibus_send_frame()
+ *
+ * Transmit the frame in the transmit buffer with the receiver off.
+ *
+ * Param:  frame length
+ * Return: nothing
+ *
+ */
+static void ibus_send_frame(uint8_t length)
+{
     uart_rx_off();
-    uart_tx_data(packet_buffer, s);
+    uart_tx_data(packet_buffer, length);
     uart_rx_on();
 }
 
@@ -185,26 +314,93 @@ static void uart_rx_off(void)
     UCSR0B &= ((~_BV(RXCIE0)) & (~_BV(RXEN0)));
 }
 
+/* ----------------------------------------------------------------------------
+ * ibus_resync()
+ *
+ *  Reset the UART receiver and the packet framing state.
+ *  Disabling the receiver flushes the receive buffer and clears
+ *  the frame error and data overrun flags. The next byte after
+ *  the reset is taken as the start of a packet.
+ *
+ * Param:  none
+ * Return: none
+ * 
+ */
+static void ibus_resync(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        uart_rx_off();
+
+        disable_gap_timer();
+        isGap = 1;
+        ibus_decoder_reset(&decoder);
+        rxDiscard = 0;
+        rxResult = IBUS_READ_RETRY;
+        pollTicks = 0;
+
+        UCSR0B |= (_BV(RXCIE0) | _BV(RXEN0));
+    }
+}
+
 /* ----------------------------------------------------------------------------
  * This ISR will trigger when the UART0 receives a data byte
  * from the RC Receiver.
  *
  */
-ISR(USART_RX_vect)
+ISR(UART_RX_vect)
 {
+    uint8_t     data;
+    int8_t      result;
+    uint16_t    now, halted, interval;
+
     if ( isGap )
     {
         /* If 'isGap' is true then this is the first byte  of a packet
            received from the RC receiver.
+           Measure the poll interval between packet starts, including
+           the time Timer1 was halted by ADC conversions.
         */
         isGap = 0;
-        inIndex = 0;
+        ibus_decoder_reset(&decoder);
+        rxDiscard = 0;
+
+        now = TCNT1;
+        halted = get_timestamp_halted();
+        interval = (now - packetStart) + (halted - packetHalted);
+        packetStart = now;
+        packetHalted = halted;
+
+        if ( interval >= IBUS_POLL_MIN_TICKS && interval <= IBUS_POLL_MAX_TICKS )
+        {
+            pollTicks = interval;
+        }
     }
 
-    if ( inIndex < IBUS_MAX_PACKET_SIZE )
+    data = UDR0;
+
+    /* Decode the packet. Only command packets, without data, are passed
+     * on. Responses of other sensors on the bus are decoded and ignored.
+     * After an error the rest of the bytes until the next gap are dropped.
+     */
+    if ( !rxDiscard )
     {
-        packet_buffer[inIndex] = UDR0;
-        inIndex++;
+        result = ibus_decode_byte(&decoder, data);
+
+        if ( result == IBUS_DECODE_FRAME &&
+             ibus_frame_length(decoder.frame) == IBUS_FRAME_OVERHEAD )
+        {
+            rxCommand = decoder.frame[1];
+            rxResult = IBUS_PACKET_OK;
+        }
+        else if ( result == IBUS_DECODE_ERROR )
+        {
+            if ( rxResult == IBUS_READ_RETRY )
+            {
+                rxResult = IBUS_CHECKSUM_ERR;
+            }
+            rxDiscard = 1;
+        }
     }
 
     /* Reset the gap watchdog timer
@@ -12,28 +12,36 @@
 
 #include    <stdint.h>
 
+#include    "ibus_codec.h"
+
 /****************************************************************************
   Definitions
 ****************************************************************************/
-#define     IBUS_CMD_DISCOVER       8
-#define     IBUS_CMD_SENSOR_TYPE    9
-#define     IBUS_CMD_SENSOR_READ   10
+/* Receiver poll interval limits, a shorter or longer interval between
+ * packets is not a poll cycle. IBUS_POLL_MAX_US must be less than half
+ * the Timer1 time stamp wrap around time.
+ */
+#define     IBUS_POLL_MIN_US     3000
+#define     IBUS_POLL_MAX_US    12000
+
+#define     IBUS_POLL_NONE      0xffff      // No poll expected, bus is silent
+
+#define     IBUS_SILENCE_MS     50          // No valid packet for ~6 poll intervals, resync the UART
 
 #define     IBUS_CHECKSUM_ERR       0
 #define     IBUS_PACKET_OK         -1
 #define     IBUS_READ_RETRY        -2
 
-typedef struct {
-    uint8_t     ibus_cmd;
-    uint8_t     ibus_sense_id;
-    uint8_t     data[4];
-} ibus_packet_t;
-
 /****************************************************************************
   Function prototypes
 ****************************************************************************/
 
 int     ibus_get_packet(uint8_t *ibus_cmd, uint8_t *ibus_sensor_id);
-void    ibus_send_packet(ibus_packet_t *packet, int data_count);
+void    ibus_send_ack(uint8_t ibus_cmd, uint8_t ibus_sensor_id);
+void    ibus_send_u16(uint8_t ibus_cmd, uint8_t ibus_sensor_id, uint16_t value);
+int     ibus_bus_idle(void);
+uint16_t ibus_time_to_poll(void);
+int     ibus_check_silence(void);
+uint16_t ibus_resync_count(void);
 
 #endif  /* __IBUS_DRV_H__ */
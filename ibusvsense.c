@@ -12,7 +12,7 @@
  *  |  |  |  |  |  |  |  |
  *  |  |  |  |  |  |  |  +--- 'o' Status LED(*) (active low)
  *  |  |  |  |  |  |  +------ 'i'
- *  |  |  |  |  |  +--------- 'i'
+ *  |  |  |  |  |  +--------- 'o' Low voltage alarm buzzer or LED (active high, optional)
  *  |  |  |  |  +------------ 'o' MOSI \
  *  |  |  |  +--------------- 'i' MISO  | In-circuit programmer
  *  |  |  +------------------ 'o' SCLK /
@@ -26,7 +26,7 @@
  *     b6 b5 b4 b3 b2 b1 b0
  *     |  |  |  |  |  |  |
  *     |  |  |  |  |  |  +--- 'i' ADC0 analog input (battery sense voltage)
- *     |  |  |  |  |  +------ 'i'
+ *     |  |  |  |  |  +------ 'i' ADC1 analog input (second pack sense voltage, optional)
  *     |  |  |  |  +--------- 'i'
  *     |  |  |  +------------ 'i'
  *     |  |  +--------------- 'i'
@@ -54,153 +54,232 @@
 
 #include    <avr/io.h>
 #include    <avr/interrupt.h>
+#include    <avr/wdt.h>
 #include    <util/delay.h>
 
 #include    "util.h"
 #include    "ibus_drv.h"
+#include    "battery.h"
+#include    "flight_log.h"
+#include    "scheduler.h"
 #include    "sensor_type.h"
 
 /****************************************************************************
   Definitions
 ****************************************************************************/
 #define     ENABLE_CAPA_SNS     0               // Set to non-zero to enable capacity sensor
+#define     ENABLE_STATS_SNS    0               // Set to non-zero to enable min/max/sag voltage sensors
+#define     BATT_INTERPOLATE    0               // Set to non-zero to interpolate battery percent between table steps
+#define     ENABLE_FLIGHT_LOG   0               // Set to non-zero to enable EEPROM flight data recorder
+#define     ENABLE_DIAG_SNS     0               // Set to non-zero to enable watchdog reset, bus resync and task load sensors
 
-#define     BATT_2S             0
-#define     BATT_3S             1
-#define     BATT_4S             2
-
-#define     BATT_SIZES          2
-#define     BATT_PERCENTS       21
 #define     DEF_BATTERY_PERCENT 100
 
 #define     STARTUP_DELAY       (2*RATE_1HZ)    // 2 seconds
 
+#define     FUEL_PERIOD         100             // mSec between battery percent updates
+#define     LOG_PERIOD          4               // mSec between flight log services, ~EEPROM write time
+
+/* Watchdog time out, the shortest watchdog period that covers
+ * WDT_POLL_COUNT receiver poll intervals. The main loop must not block longer.
+ */
+#define     POLL_INTERVAL_MS    8               // Nominal receiver poll interval, ~7.7mSec
+#define     WDT_POLL_COUNT      8
+#define     WDT_TIMEOUT_MS      (WDT_POLL_COUNT * POLL_INTERVAL_MS)
+
+#if ( WDT_TIMEOUT_MS <= 15 )
+#define     WDT_TIMEOUT         WDTO_15MS
+#elif ( WDT_TIMEOUT_MS <= 30 )
+#define     WDT_TIMEOUT         WDTO_30MS
+#elif ( WDT_TIMEOUT_MS <= 60 )
+#define     WDT_TIMEOUT         WDTO_60MS
+#elif ( WDT_TIMEOUT_MS <= 120 )
+#define     WDT_TIMEOUT         WDTO_120MS
+#else
+#define     WDT_TIMEOUT         WDTO_250MS
+#endif
+
+/****************************************************************************
+  Types
+****************************************************************************/
+typedef enum {
+    SENSOR_VOLTAGE,                             // Battery voltage
+    SENSOR_FUEL,                                // Remaining battery percent
+    SENSOR_VOLTAGE2,                            // Second pack voltage
+    SENSOR_FUEL2,                               // Second pack remaining percent
+    SENSOR_VOLTAGE_MIN,                         // Lowest battery voltage
+    SENSOR_VOLTAGE_MAX,                         // Highest battery voltage
+    SENSOR_VOLTAGE_SAG,                         // Deepest voltage sag below rest voltage
+    SENSOR_VOLTAGE2_MIN,                        // Lowest second pack voltage
+    SENSOR_VOLTAGE2_MAX,                        // Highest second pack voltage
+    SENSOR_VOLTAGE2_SAG,                        // Deepest second pack voltage sag
+    SENSOR_TEMPERATURE,                         // Internal temperature sensor
+    SENSOR_WDT_RESETS,                          // Watchdog resets, persisted in EEPROM
+    SENSOR_BUS_RESYNCS,                         // Bus silence resyncs since power up
+    SENSOR_TASK_LOAD,                           // Worst task run time in percent of its budget
+} sensor_reading_t;
+
+typedef struct {
+    uint8_t     type;                           // i.bus sensor type
+    uint8_t     reading;                        // sensor_reading_t
+} sensor_t;
+
 /****************************************************************************
   Function prototypes
 ****************************************************************************/
-uint8_t     get_battery_percent(uint16_t adc_value);
+uint8_t     get_battery_percent(uint16_t battery_volts);
+uint16_t    get_sensor_value(uint8_t reading);
+
+void        task_adc(void);
+#if ( ENABLE_CAPA_SNS )
+void        task_fuel(void);
+#endif
+#if ( ENABLE_FLIGHT_LOG )
+void        task_log(void);
+#endif
 
 /****************************************************************************
   Globals
 ****************************************************************************/
-uint16_t    startup_time_mark;
+uint32_t    startup_time_mark;
+uint8_t     battery_percent_value = DEF_BATTERY_PERCENT;
+#if ( ENABLE_PACK2_SNS )
+uint8_t     battery2_percent_value = DEF_BATTERY_PERCENT;
+#endif
+uint8_t     wdt_reset_count;                    // EEPROM counter copy, EEPROM reads wait for log writes
 
-uint16_t    battery_capacity[BATT_PERCENTS][BATT_SIZES] =
+/* Sensor list, sensor IDs are assigned in list order starting at 1
+ */
+const sensor_t  sensors[] =
 {
-/* Values are fixed point at 0.01v per LSB
- *
- *         3S    4S
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE },
+#if ( ENABLE_CAPA_SNS )
+    { IBUS_SENSOR_TYPE_FUEL,             SENSOR_FUEL },
+#endif
+#if ( ENABLE_PACK2_SNS )
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE2 },
+#if ( ENABLE_CAPA_SNS )
+    { IBUS_SENSOR_TYPE_FUEL,             SENSOR_FUEL2 },
+#endif
+#endif
+#if ( ENABLE_STATS_SNS )
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE_MIN },
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE_MAX },
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE_SAG },
+#if ( ENABLE_PACK2_SNS )
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE2_MIN },
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE2_MAX },
+    { IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE, SENSOR_VOLTAGE2_SAG },
+#endif
+#endif
+#if ( ENABLE_TEMP_SNS )
+    { IBUS_SENSOR_TYPE_TEMPERATURE,      SENSOR_TEMPERATURE },
+#endif
+#if ( ENABLE_DIAG_SNS )
+    { IBUS_SENSOR_TYPE_ODO1,             SENSOR_WDT_RESETS },
+    { IBUS_SENSOR_TYPE_ODO2,             SENSOR_BUS_RESYNCS },
+    { IBUS_SENSOR_TYPE_FUEL,             SENSOR_TASK_LOAD },
+#endif
+};
+
+#define     SENSOR_COUNT        (sizeof(sensors) / sizeof(sensor_t))
+
+/* Background tasks, run in the bus gaps in priority order.
+ * Budgets are worst case estimates in CPU cycles. The scheduler measures
+ * every run, check the budgets with the task load diagnostic sensor
+ * (ENABLE_DIAG_SNS), it must stay below 100%.
  */
-        {  982, 1309 },    // 0%
-        { 1083, 1443 },    // 5%
-        { 1106, 1475 },    // 10%
-        { 1112, 1483 },    // 15%
-        { 1118, 1491 },    // 20% << discharge danger point
-        { 1124, 1499 },    // 25%
-        { 1130, 1506 },    // 30%
-        { 1136, 1514 },    // 35%
-        { 1139, 1518 },    // 40%
-        { 1145, 1526 },    // 45%
-        { 1151, 1534 },    // 50%
-        { 1156, 1542 },    // 55%
-        { 1162, 1550 },    // 60%
-        { 1174, 1566 },    // 65%
-        { 1186, 1581 },    // 70%
-        { 1195, 1593 },    // 75%
-        { 1207, 1609 },    // 80%
-        { 1225, 1633 },    // 85%
-        { 1233, 1645 },    // 90%
-        { 1245, 1660 },    // 95%
-        { 1260, 1680 },    // 100%
+const sched_task_t  tasks[] =
+{
+#if ( ENABLE_PACK2_SNS )
+    { task_adc,  0,           SCHED_CYCLES(4000) },     // 2 x 13 ADC clocks at Fclk/128 in sleep
+#if ( ENABLE_CAPA_SNS )
+    { task_fuel, FUEL_PERIOD, SCHED_CYCLES(3000) },
+#endif
+#else
+    { task_adc,  0,           SCHED_CYCLES(2000) },     // 13 ADC clocks at Fclk/128 in sleep
+#if ( ENABLE_CAPA_SNS )
+    { task_fuel, FUEL_PERIOD, SCHED_CYCLES(1500) },
+#endif
+#endif
+#if ( ENABLE_FLIGHT_LOG )
+    { task_log,  LOG_PERIOD,  SCHED_CYCLES(2500) },
+#endif
 };
 
+#define     TASK_COUNT          (sizeof(tasks) / sizeof(sched_task_t))
+
 /* ----------------------------------------------------------------------------
  * main() control functions
  *
  */
 int main(void)
 {
-    uint8_t         battery_percent;
+    uint16_t        sensor_value;
+    const sensor_t *sensor;
     int             ibus_result;
     uint8_t         ibus_cmd, ibus_sensor_id;
-    ibus_packet_t   packet;
-
-    uint32_t        adc_value = 0;
 
     /* Initialize IO devices and
      * enable interrupts
      */
     ioinit();
+    reset_count_update();
+    wdt_reset_count = get_reset_count(RESET_CAUSE_WDT);
+#if ( ENABLE_FLIGHT_LOG )
+    log_init();
+#endif
     sei();
 
+    wdt_enable(WDT_TIMEOUT);
+
     startup_time_mark = get_global_time();
+    sched_init(tasks, TASK_COUNT);
 
     /* Loop forever
      */
     while ( 1 )
     {
+        wdt_reset();
+
+        /* Resynchronize the UART if the bus went silent
+         */
+        ibus_check_silence();
+
         /* Read the ibus and process packets
          */
         ibus_result = ibus_get_packet(&ibus_cmd, &ibus_sensor_id);
 
-        if ( ibus_result == IBUS_PACKET_OK )
+        if ( ibus_result == IBUS_READ_RETRY )
         {
-            packet.ibus_cmd = ibus_cmd;
-            packet.ibus_sense_id = ibus_sensor_id;
+            /* No packet yet, run background tasks
+             * if the bus is in the gap between packets.
+             */
+            sched_dispatch();
 
-            if ( ibus_cmd == IBUS_CMD_DISCOVER )
-            {
-                if ( ibus_sensor_id == 1
-#if ( ENABLE_CAPA_SNS )
-                     || ibus_sensor_id == 2
-#endif
-                   )
-                {
-                    ibus_send_packet(&packet, 0);
-                }
-            }
-            else if ( ibus_cmd == IBUS_CMD_SENSOR_TYPE )
+            continue;
+        }
+
+        if ( ibus_result == IBUS_PACKET_OK )
+        {
+            if ( ibus_sensor_id >= 1 && ibus_sensor_id <= SENSOR_COUNT )
             {
-                if ( ibus_sensor_id == 1 )
-                {
-                    packet.data[0] = IBUS_SENSOR_TYPE_EXTERNAL_VOLTAGE;
-                    packet.data[1] = 2;
-                    ibus_send_packet(&packet, 2);
-                }
-                else if ( ibus_sensor_id == 2 )
+                sensor = &sensors[(ibus_sensor_id - 1)];
+
+                if ( ibus_cmd == IBUS_CMD_DISCOVER )
                 {
-                    packet.data[0] = IBUS_SENSOR_TYPE_FUEL;
-                    packet.data[1] = 2;
-                    ibus_send_packet(&packet, 2);
+                    ibus_send_ack(ibus_cmd, ibus_sensor_id);
                 }
-            }
-            else if ( ibus_cmd == IBUS_CMD_SENSOR_READ )
-            {
-                if ( ibus_sensor_id == 1 )
+                else if ( ibus_cmd == IBUS_CMD_SENSOR_TYPE )
                 {
-                    /* Read and convert ADC reading
-                     * to battery voltage in 0.01v/per MSB bit units.
-                     * Calculation order is IMPORTANT in order to
-                     * maintain accuracy and stay within 16-bits.
+                    /* Sensor type and its 2-byte value length
                      */
-                    adc_value = get_adc();
-                    adc_value *= 33;    // Zener ADC reference 3.3v
-                    adc_value *= 57;    // Resistor divider 5.7:1
-                    adc_value >>= 8;    // ADC readout scaling
-
-                    packet.data[0] = (uint8_t)(adc_value & 0xff);
-                    packet.data[1] = (uint8_t)(adc_value >> 8);
-                    ibus_send_packet(&packet, 2);
+                    ibus_send_u16(ibus_cmd, ibus_sensor_id, sensor->type | (2 << 8));
                 }
-                else if ( ibus_sensor_id == 2 )
+                else if ( ibus_cmd == IBUS_CMD_SENSOR_READ )
                 {
-                    /* Calculate remaining battery percent
-                     */
-                    battery_percent = get_battery_percent((uint16_t) adc_value);
-
-                    packet.data[0] = battery_percent;
-                    packet.data[1] = 0;
-                    ibus_send_packet(&packet, 2);
+                    sensor_value = get_sensor_value(sensor->reading);
+                    ibus_send_u16(ibus_cmd, ibus_sensor_id, sensor_value);
                 }
             }
 
@@ -212,6 +291,9 @@ int main(void)
          */
         else
         {
+#if ( ENABLE_FLIGHT_LOG )
+            log_count_error();
+#endif
             status_led_off();
         }
     }
@@ -219,57 +301,178 @@ int main(void)
     return 0;
 }
 
+/* ----------------------------------------------------------------------------
+ * get_sensor_value()
+ *
+ *  Read and convert a sensor value to its i.bus units
+ *
+ *  param:  sensor reading type
+ *  return: sensor value, voltages in 0.01v/per LSB units, temperature in 0.1'C units + 40'C
+ *
+ */
+uint16_t get_sensor_value(uint8_t reading)
+{
+    adc_stats_t     stats;
+
+    switch ( reading )
+    {
+        case SENSOR_VOLTAGE:
+            return battery_voltage(get_adc());
+
+        case SENSOR_FUEL:
+            return battery_percent_value;
+
+#if ( ENABLE_PACK2_SNS )
+        case SENSOR_VOLTAGE2:
+            return battery2_voltage(get_adc2());
+
+        case SENSOR_FUEL2:
+            return battery2_percent_value;
+#endif
+
+        case SENSOR_VOLTAGE_MIN:
+            get_adc_stats(ADC_CHANNEL_PACK, &stats);
+            return (stats.min > stats.max) ? 0 : battery_voltage(stats.min);
+
+        case SENSOR_VOLTAGE_MAX:
+            get_adc_stats(ADC_CHANNEL_PACK, &stats);
+            return battery_voltage(stats.max);
+
+        case SENSOR_VOLTAGE_SAG:
+            get_adc_stats(ADC_CHANNEL_PACK, &stats);
+            return battery_voltage(stats.sag);
+
+#if ( ENABLE_PACK2_SNS )
+        case SENSOR_VOLTAGE2_MIN:
+            get_adc_stats(ADC_CHANNEL_PACK2, &stats);
+            return (stats.min > stats.max) ? 0 : battery2_voltage(stats.min);
+
+        case SENSOR_VOLTAGE2_MAX:
+            get_adc_stats(ADC_CHANNEL_PACK2, &stats);
+            return battery2_voltage(stats.max);
+
+        case SENSOR_VOLTAGE2_SAG:
+            get_adc_stats(ADC_CHANNEL_PACK2, &stats);
+            return battery2_voltage(stats.sag);
+#endif
+
+        case SENSOR_TEMPERATURE:
+            return get_temperature();
+
+        case SENSOR_WDT_RESETS:
+            return wdt_reset_count;
+
+        case SENSOR_BUS_RESYNCS:
+            return ibus_resync_count();
+
+        case SENSOR_TASK_LOAD:
+            return sched_worst_load();
+    }
+
+    return 0;
+}
+
 /* ----------------------------------------------------------------------------
  * get_battery_percent()
  *
- *  Convert ADC voltage (fixed point 0.01v per LSB) to battery percent
+ *  Convert battery voltage (fixed point 0.01v per LSB) to battery percent
  *
- *  param:  ADC readout
+ *  param:  battery voltage
  *  return: battery percent 0 to 100
  *
  */
-uint8_t get_battery_percent(uint16_t adc_value)
+uint8_t get_battery_percent(uint16_t battery_volts)
 {
-    int         x;
-
     static int  startup_delay = 1;
-    int  battery_size = -1;
 
     /* Return a bogus battery full for STARTUP_DELAY seconds
      * until system stabilizes.
      */
     if ( startup_delay &&
-         (uint16_t)(get_global_time() - startup_time_mark) < STARTUP_DELAY )
+         (get_global_time() - startup_time_mark) < STARTUP_DELAY )
     {
         return DEF_BATTERY_PERCENT;
     }
 
     startup_delay = 0;
 
-    /* Determine battery size
-     * and then battery percent
-     */
-    for ( x = 0; x < BATT_SIZES; x++ )
+#if ( BATT_INTERPOLATE )
+    return battery_percent_interpolated(battery_volts);
+#else
+    return battery_percent(battery_volts);
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ * task_adc()
+ *
+ *  Run a requested ADC conversion in noise reduction sleep.
+ *  The scheduler dispatches this task only when its budget, the whole
+ *  ADC scan, fits before the next expected poll. Do not call it from
+ *  outside the scheduler. Interrupts are disabled so the gap cannot end
+ *  between the bus idle check and the sleep.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void task_adc(void)
+{
+    cli();
+    if ( adc_conversion_due() && ibus_bus_idle() )
     {
-        if ( adc_value >= battery_capacity[0][x] &&
-             adc_value <= battery_capacity[20][x] )
-        {
-            battery_size = x;
-            break;
-        }
+        adc_convert();
     }
+    sei();
+}
+
+#if ( ENABLE_CAPA_SNS )
+/* ----------------------------------------------------------------------------
+ * task_fuel()
+ *
+ *  Update the battery percent readings from the filtered voltages.
+ *  The second pack is estimated as an equivalent pack of the capacity
+ *  table's cell count.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void task_fuel(void)
+{
+    battery_percent_value = get_battery_percent(battery_voltage(get_adc()));
+#if ( ENABLE_PACK2_SNS )
+    battery2_percent_value = get_battery_percent(battery_equivalent_voltage(battery2_voltage(get_adc2()), BATT2_CELLS));
+#endif
+}
+#endif
+
+#if ( ENABLE_FLIGHT_LOG )
+/* ----------------------------------------------------------------------------
+ * task_log()
+ *
+ *  Update the flight log and start an EEPROM write.
+ *  Logging starts after the ADC filter settled, and is retried on the
+ *  next run while the write queue is full.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void task_log(void)
+{
+    static int  log_started = 0;
+    uint8_t     adc_value;
+
+    adc_value = get_adc();
 
-    if ( battery_size != -1 )
+    if ( !log_started &&
+         (get_global_time() - startup_time_mark) >= STARTUP_DELAY )
     {
-        for ( x = 0; x < (BATT_PERCENTS-1) ; x++ )
-        {
-            if ( adc_value > battery_capacity[x][battery_size] &&
-                 adc_value <= battery_capacity[(x + 1)][battery_size] )
-            {
-                return (x * 5);
-            }
-        }
+        log_started = log_start(battery_cells(battery_voltage(adc_value)), adc_value);
     }
 
-    return 0;
+    log_update(adc_value);
+    log_service();
 }
+#endif
@@ -0,0 +1,203 @@
+/*****************************************************************************
+* scheduler.c
+*
+* Cooperative background task scheduler.
+*
+* Periodic tasks run to completion in the bus gap between i.BUS polls.
+* Every task declares its worst case run time in CPU cycles. A task is
+* dispatched only when it is due, the bus is idle, and its budget plus a
+* guard time fits before the next expected poll, so a bus response is
+* never delayed by background work.
+* Tasks are checked in table order, which is also their priority.
+* The dispatcher measures every run with the Timer1 time stamps and keeps
+* the worst case run time of each task, and counts runs that exceeded
+* their budget, so the declared budgets can be checked on the sensor.
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#include    <stdint.h>
+
+#include    "util.h"
+#include    "ibus_drv.h"
+#include    "scheduler.h"
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     SCHED_GUARD_TICKS   ((uint16_t) US_TO_TIMESTAMP(SCHED_GUARD_US))
+
+/****************************************************************************
+  Globals
+****************************************************************************/
+static const sched_task_t  *sched_tasks;
+static uint8_t              sched_task_count = 0;
+static uint16_t             sched_mark[SCHED_MAX_TASKS];   // mSec time of last run
+static uint16_t             sched_worst[SCHED_MAX_TASKS];  // Worst case run time, Timer1 ticks
+static uint16_t             sched_overruns = 0;            // Runs longer than their budget
+
+/* ----------------------------------------------------------------------------
+ * sched_init()
+ *
+ *  Register the task table, all periodic tasks are first due one
+ *  period from now.
+ *
+ *  param:  pointer to task table and task count, up to SCHED_MAX_TASKS
+ *  return: none
+ *
+ */
+void sched_init(const sched_task_t *tasks, uint8_t count)
+{
+    uint8_t     i;
+    uint16_t    now;
+
+    if ( count > SCHED_MAX_TASKS )
+    {
+        count = SCHED_MAX_TASKS;
+    }
+
+    now = (uint16_t) get_global_time();
+
+    for ( i = 0; i < count; i++ )
+    {
+        sched_mark[i] = now;
+    }
+
+    sched_tasks = tasks;
+    sched_task_count = count;
+}
+
+/* ----------------------------------------------------------------------------
+ * sched_dispatch()
+ *
+ *  Run every due task that fits in the time left before the next expected
+ *  bus poll. The time left is checked again before each task, and the
+ *  dispatcher returns as soon as the bus is no longer idle.
+ *  A due task that does not fit is deferred to the next gap.
+ *  Call from the main loop while no packet is waiting.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void sched_dispatch(void)
+{
+    uint8_t             i;
+    uint16_t            now, start, halted, elapsed;
+    const sched_task_t *task;
+
+    for ( i = 0; i < sched_task_count; i++ )
+    {
+        if ( !ibus_bus_idle() )
+        {
+            return;
+        }
+
+        task = &sched_tasks[i];
+        now = (uint16_t) get_global_time();
+
+        if ( (uint16_t)(now - sched_mark[i]) < task->period )
+        {
+            continue;
+        }
+
+        if ( ibus_time_to_poll() < (uint16_t)(task->budget + SCHED_GUARD_TICKS) )
+        {
+            continue;
+        }
+
+        /* Keep the average period of late tasks, unless
+         * the task fell more than a period behind
+         */
+        sched_mark[i] += task->period;
+        if ( (uint16_t)(now - sched_mark[i]) >= task->period )
+        {
+            sched_mark[i] = now;
+        }
+
+        start = get_timestamp();
+        halted = get_timestamp_halted();
+
+        task->run();
+
+        /* Timer1 is halted during ADC conversions, add the lost time
+         */
+        elapsed = (get_timestamp() - start) + (get_timestamp_halted() - halted);
+
+        if ( elapsed > sched_worst[i] )
+        {
+            sched_worst[i] = elapsed;
+        }
+
+        if ( elapsed > task->budget && sched_overruns < 0xffff )
+        {
+            sched_overruns++;
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * sched_worst_time()
+ *
+ *  Worst case measured run time of a task since power up,
+ *  including the interrupts that ran during the task.
+ *
+ *  param:  task table index
+ *  return: run time in uSec, 0 if the task did not run
+ *
+ */
+uint16_t sched_worst_time(uint8_t task)
+{
+    if ( task >= sched_task_count )
+    {
+        return 0;
+    }
+
+    return (uint16_t) TIMESTAMP_TO_US(sched_worst[task]);
+}
+
+/* ----------------------------------------------------------------------------
+ * sched_worst_load()
+ *
+ *  Highest ratio of worst case measured run time to declared budget
+ *  over all tasks. Above 100 a budget is too low, and that task can
+ *  overlap a poll.
+ *
+ *  param:  none
+ *  return: worst case run time in percent of budget, saturates at 255
+ *
+ */
+uint8_t sched_worst_load(void)
+{
+    uint8_t     i;
+    uint32_t    load, worst_load;
+
+    worst_load = 0;
+
+    for ( i = 0; i < sched_task_count; i++ )
+    {
+        load = ((uint32_t) sched_worst[i] * 100UL) / sched_tasks[i].budget;
+
+        if ( load > worst_load )
+        {
+            worst_load = load;
+        }
+    }
+
+    return (worst_load > 255) ? 255 : (uint8_t) worst_load;
+}
+
+/* ----------------------------------------------------------------------------
+ * sched_overrun_count()
+ *
+ *  Number of task runs that exceeded their budget since power up.
+ *
+ *  param:  none
+ *  return: overrun count, saturates at 65535
+ *
+ */
+uint16_t sched_overrun_count(void)
+{
+    return sched_overruns;
+}
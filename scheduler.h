@@ -0,0 +1,50 @@
+/*****************************************************************************
+* scheduler.h
+*
+* Cooperative background task scheduler header file
+*
+* Created: October 2026
+*
+*****************************************************************************/
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include    <stdint.h>
+
+#include    "board.h"
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     SCHED_MAX_TASKS     8
+
+/* Worst case task run time declared in CPU cycles,
+ * stored as Timer1 time stamp ticks
+ */
+#define     SCHED_CYCLES(c)     ((uint16_t) CYCLES_TO_TIMESTAMP(c))
+
+/* Safety margin before the next expected poll, covers the dispatcher,
+ * interrupt load and the Timer1 halt during an ADC conversion
+ */
+#define     SCHED_GUARD_US      300
+
+/****************************************************************************
+  Types
+****************************************************************************/
+typedef struct {
+    void      (*run)(void);                     // Task function, runs to completion
+    uint16_t    period;                         // mSec between runs, 0=every dispatch
+    uint16_t    budget;                         // Worst case run time, SCHED_CYCLES()
+} sched_task_t;
+
+/****************************************************************************
+  Function prototypes
+****************************************************************************/
+void    sched_init(const sched_task_t *tasks, uint8_t count);
+void    sched_dispatch(void);
+uint16_t sched_worst_time(uint8_t task);
+uint8_t  sched_worst_load(void);
+uint16_t sched_overrun_count(void);
+
+#endif  /* __SCHEDULER_H__ */
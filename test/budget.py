@@ -0,0 +1,289 @@
+#!/usr/bin/python3
+#####################################################################
+#
+# budget.py
+#
+#   Flash, SRAM and stack budget report of the sensor firmware.
+#
+#   Memory   - per-symbol flash and SRAM sizes from the linker map
+#              file. The sources are compiled with -ffunction-sections
+#              and -fdata-sections, so every function and variable is
+#              its own input section in the map.
+#   Stack    - static worst case stack depth from the -fstack-usage
+#              .su files and a call graph from the ELF disassembly.
+#              avr-gcc's .su sizes include the pushed registers and the
+#              return address. Indirect calls (icall) may reach every
+#              function whose address is taken in the object files.
+#              AVR interrupts do not nest unless an ISR enables them,
+#              so the worst case is the deepest main path plus the
+#              deepest ISR, plus every ISR that executes 'sei'.
+#              Functions without stack usage (libgcc, avr-libc) are
+#              counted with their return address only and listed.
+#   Budget   - exit with status 1 when flash use or the SRAM use
+#              including the worst case stack exceed the budget
+#              percentage of the MCU's memory.
+#
+#   python3 budget.py --map <map> --elf <elf> --ram <bytes> --flash <bytes>
+#                     [--ram-budget %] [--flash-budget %] [--objdump <prog>]
+#                     [--top N] [--su <.su files>] [--objs <.o files>]
+#
+#####################################################################
+
+import argparse
+import re
+import subprocess
+import sys
+
+RETURN_ADDRESS = 2          # Return address bytes, parts up to 128K flash
+VECTOR_PREFIX = '__vector_'
+
+# Output sections and the memories they use, .data is
+# held in flash and copied to SRAM on start up
+SECTION_MEMORY = {
+    '.vectors': ('flash',),
+    '.text':    ('flash',),
+    '.rodata':  ('flash',),
+    '.data':    ('flash', 'ram'),
+    '.bss':     ('ram',),
+    '.noinit':  ('ram',),
+}
+
+CALLS = ('call', 'rcall', 'icall', 'eicall')
+JUMPS = ('jmp', 'rjmp')
+
+
+
+def parse_map(path):
+    '''
+    Read input section sizes from a GNU ld map file.
+    Returns a list of (memory tuple, symbol, size, object file).
+    '''
+    symbols = []
+    output_section = None
+    in_map = False
+
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    i = 0
+    while i < len(lines):
+        line = lines[i]
+        i += 1
+
+        if line.startswith('Linker script and memory map'):
+            in_map = True
+            continue
+        if not in_map or not line.strip():
+            continue
+
+        # Output section header at column 0
+        m = re.match(r'^(\.\w+)\b', line)
+        if m:
+            output_section = m.group(1) if m.group(1) in SECTION_MEMORY else None
+            continue
+        if output_section is None:
+            continue
+
+        # Input section, address and size on the same or the next line
+        m = re.match(r'^ (\.\S+|COMMON)\s*(.*)$', line)
+        if not m:
+            continue
+        name, rest = m.group(1), m.group(2)
+        if not rest and i < len(lines):
+            rest = lines[i].strip()
+            i += 1
+        m = re.match(r'^(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)\s+(\S.*)$', rest)
+        if not m:
+            continue
+        size = int(m.group(2), 16)
+        obj = m.group(3).split('/')[-1]
+        if size == 0:
+            continue
+
+        # The symbol is the section name suffix, or the symbols
+        # listed after a generic section
+        symbol = None
+        for prefix in ('.text.', '.rodata.', '.data.', '.bss.', '.noinit.'):
+            if name.startswith(prefix):
+                symbol = name[len(prefix):]
+        if symbol is None:
+            names = []
+            while i < len(lines) and re.match(r'^\s+0x[0-9a-fA-F]+\s+\w+$', lines[i]):
+                names.append(lines[i].split()[1])
+                i += 1
+            symbol = names[0] if len(names) == 1 else '{} {}'.format(name, obj)
+
+        symbols.append((SECTION_MEMORY[output_section], symbol, size, obj))
+
+    return symbols
+
+def parse_stack_usage(paths):
+    '''
+    Read function frame sizes from .su files.
+    Returns a dictionary of function name to (bytes, qualifier).
+    '''
+    frames = {}
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                fields = line.rstrip('\n').split('\t')
+                if len(fields) < 3:
+                    continue
+                function = fields[0].split(':')[-1]
+                frames[function] = (int(fields[1]), fields[2])
+    return frames
+
+def address_taken(objdump, objects):
+    '''
+    Functions whose program memory address is taken in the object files,
+    the possible targets of indirect calls.
+    '''
+    taken = set()
+    for obj in objects:
+        output = subprocess.run([objdump, '-r', obj], capture_output=True, text=True, check=True).stdout
+        for line in output.splitlines():
+            fields = line.split()
+            if len(fields) == 3 and ('_PM' in fields[1] or '_GS' in fields[1]):
+                taken.add(fields[2].split('+')[0])
+    return taken
+
+def call_graph(objdump, elf):
+    '''
+    Build the call graph from the ELF disassembly.
+    Returns a dictionary of function name to a set of callees, and the set
+    of functions that call indirectly or enable interrupts.
+    '''
+    graph = {}
+    indirect = set()
+    enables = set()
+    function = None
+
+    output = subprocess.run([objdump, '-d', elf], capture_output=True, text=True, check=True).stdout
+    for line in output.splitlines():
+        m = re.match(r'^[0-9a-fA-F]+ <([^>]+)>:$', line)
+        if m:
+            function = m.group(1)
+            graph.setdefault(function, set())
+            continue
+        if function is None:
+            continue
+
+        m = re.match(r'^\s*[0-9a-fA-F]+:\s+(?:[0-9a-fA-F]{2} )+\s*(\w+)\s*(.*)$', line)
+        if not m:
+            continue
+        mnemonic, operands = m.group(1), m.group(2)
+
+        if mnemonic in ('icall', 'eicall'):
+            indirect.add(function)
+        elif mnemonic == 'sei':
+            enables.add(function)
+        elif mnemonic in CALLS or mnemonic in JUMPS:
+            target = re.search(r'<([^>+]+)(\+0x[0-9a-fA-F]+)?>', operands)
+            # Jumps to another function are tail calls
+            if target and (mnemonic in CALLS or target.group(1) != function):
+                graph[function].add(target.group(1))
+
+    return graph, indirect, enables
+
+def stack_depth(function, graph, frames, indirect, taken, unknown, path=()):
+    '''
+    Worst case stack depth of a function and its callees.
+    Returns (bytes, call path).
+    '''
+    if function in path:
+        raise ValueError('recursion: ' + ' -> '.join(path + (function,)))
+
+    if function in frames:
+        own = frames[function][0]
+        if frames[function][1] != 'static':
+            unknown.add(function + ' (' + frames[function][1] + ')')
+    else:
+        own = RETURN_ADDRESS
+        unknown.add(function)
+
+    callees = set(graph.get(function, ()))
+    if function in indirect:
+        callees |= taken
+
+    deepest, deepest_path = 0, ()
+    for callee in sorted(callees):
+        depth, callee_path = stack_depth(callee, graph, frames, indirect, taken, unknown, path + (function,))
+        if depth > deepest:
+            deepest, deepest_path = depth, callee_path
+
+    return own + deepest, (function,) + deepest_path
+
+def main():
+    parser = argparse.ArgumentParser(description='Flash, SRAM and stack budget report')
+    parser.add_argument('--map', required=True, help='linker map file')
+    parser.add_argument('--elf', required=True, help='linked ELF file')
+    parser.add_argument('--flash', type=int, required=True, help='MCU flash size in bytes')
+    parser.add_argument('--ram', type=int, required=True, help='MCU SRAM size in bytes')
+    parser.add_argument('--flash-budget', type=int, default=100, help='flash budget in percent')
+    parser.add_argument('--ram-budget', type=int, default=100, help='SRAM budget in percent, including the stack')
+    parser.add_argument('--objdump', default='avr-objdump', help='objdump program')
+    parser.add_argument('--top', type=int, default=15, help='largest symbols to list')
+    parser.add_argument('--su', nargs='*', default=[], help='stack usage files')
+    parser.add_argument('--objs', nargs='*', default=[], help='object files')
+    args = parser.parse_args()
+
+    # Memory
+    symbols = parse_map(args.map)
+    used = {'flash': 0, 'ram': 0}
+    for memories, symbol, size, obj in symbols:
+        for memory in memories:
+            used[memory] += size
+
+    for memory, title in (('flash', 'Flash'), ('ram', 'SRAM (static)')):
+        print('{} {} bytes'.format(title, used[memory]))
+        listed = sorted((s for s in symbols if memory in s[0]), key=lambda s: -s[2])
+        for memories, symbol, size, obj in listed[:args.top]:
+            print('  {:6d}  {:32s} {}'.format(size, symbol, obj))
+        print()
+
+    # Stack
+    frames = parse_stack_usage(args.su)
+    graph, indirect, enables = call_graph(args.objdump, args.elf)
+    taken = address_taken(args.objdump, args.objs) if args.objs else set()
+    unknown = set()
+
+    print('Stack')
+    try:
+        main_depth, main_path = stack_depth('main', graph, frames, indirect, taken, unknown)
+        isrs = [(isr,) + stack_depth(isr, graph, frames, indirect, taken, unknown)
+                for isr in sorted(f for f in graph if f.startswith(VECTOR_PREFIX))]
+    except ValueError as e:
+        print('  no static stack estimate, ' + str(e))
+        sys.exit(1)
+    print('  {:6d}  main: {}'.format(main_depth, ' -> '.join(main_path)))
+
+    isr_block, isr_nest = 0, 0
+    for isr, depth, path in isrs:
+        nests = isr in enables
+        print('  {:6d}  {}{}: {}'.format(depth, isr, ' (nests)' if nests else '', ' -> '.join(path)))
+        if nests:
+            isr_nest += depth
+        else:
+            isr_block = max(isr_block, depth)
+
+    stack = main_depth + isr_block + isr_nest
+    print('  {:6d}  worst case, main and interrupts'.format(stack))
+    if unknown:
+        print('  no static stack usage: ' + ', '.join(sorted(unknown)))
+    print()
+
+    # Budget
+    failed = False
+    for memory, title, total, size, budget in (
+            ('flash', 'Flash', used['flash'], args.flash, args.flash_budget),
+            ('ram', 'SRAM', used['ram'] + stack, args.ram, args.ram_budget)):
+        limit = size * budget // 100
+        status = 'ok' if total <= limit else 'OVER BUDGET'
+        print('{:6s} {:6d} of {:6d} bytes ({:5.1f}%), budget {}% {}'.format(
+              title, total, size, total * 100.0 / size, budget, status))
+        failed |= total > limit
+
+    sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,370 @@
+/*****************************************************************************
+* codec_bench.c
+*
+*   Host benchmark and cross-check of the i.BUS frame codec (../ibus_codec.h).
+*
+*   Without options the program measures the streaming decoder throughput
+*   over a random mix of command frames and 2 and 4 byte sensor responses,
+*   and reports host CPU cycles and nanoseconds per byte (relative cost
+*   only, not AVR cycles).
+*
+*   With '--check' the program reads a stream of frames built by the
+*   Python reference (codec_check.py) from stdin. Every frame must decode
+*   exactly at its last byte, re-encode to the same bytes with
+*   ibus_frame_finish() and the IBUS_FRAME_*() macros, and be rejected
+*   with a corrupted checksum.
+*
+*   Build and run with 'make codecbench' and 'make codeccheck' from the
+*   project directory, or:
+*     cc -O2 -I.. -o codec_bench codec_bench.c
+*     ./codec_bench [-n frames]
+*     python3 codec_check.py ./codec_bench
+*
+*****************************************************************************/
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <stdint.h>
+#include    <string.h>
+#include    <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include    <x86intrin.h>
+#endif
+
+#include    "ibus_codec.h"
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     BENCH_FRAMES        1000000
+#define     BENCH_REPEAT        20
+#define     CHECK_CHUNK         65536
+
+/* Compile time checksum of a constant frame, the sensor #1 read
+ * command 04 a1 5a ff captured from a FlySky receiver
+ */
+static const uint8_t    read_cmd[] = IBUS_FRAME_CMD(IBUS_CMD_SENSOR_READ, 1);
+typedef char read_cmd_check[(IBUS_CHECKSUM(4 + IBUS_CMD_BYTE(IBUS_CMD_SENSOR_READ, 1)) == 0xff5a) ? 1 : -1];
+
+/****************************************************************************
+  Globals
+****************************************************************************/
+static uint32_t     rand_state = 1;
+
+/* ----------------------------------------------------------------------------
+ * cycles_now()
+ *
+ *  Host cycle counter, or nanoseconds when no cycle counter is available.
+ *
+ */
+static uint64_t cycles_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ * nsec_now()
+ *
+ */
+static uint64_t nsec_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ----------------------------------------------------------------------------
+ * random32()
+ *
+ *  Repeatable xorshift32 random numbers.
+ *
+ */
+static uint32_t random32(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+
+    return rand_state;
+}
+
+/* ----------------------------------------------------------------------------
+ * bench()
+ *
+ *  Decode throughput over a random mix of frames as seen on a sensor bus.
+ *
+ */
+static int bench(long frames)
+{
+    uint8_t        *stream, *frame;
+    size_t          size, offset;
+    long            i, decoded, errors;
+    int             r, count;
+    uint32_t        value;
+    uint64_t        cycles, nsec, start_cycles, start_nsec;
+    ibus_decoder_t  decoder;
+
+    stream = malloc(frames * IBUS_FRAME_MAX);
+    if ( stream == NULL )
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* Half command frames, the rest sensor responses
+     */
+    size = 0;
+    for ( i = 0; i < frames; i++ )
+    {
+        frame = stream + size;
+        value = random32();
+        count = (value & 1) ? 0 : ((value & 2) ? 2 : 4);
+
+        memcpy(ibus_frame_payload(frame), &value, count);
+        size += ibus_frame_finish(frame, IBUS_CMD_DISCOVER + (value >> 8) % 3, (value >> 16) & 0x0f, count);
+    }
+
+    cycles = (uint64_t) -1;
+    nsec = (uint64_t) -1;
+    decoded = 0;
+    errors = 0;
+
+    for ( r = 0; r < BENCH_REPEAT; r++ )
+    {
+        ibus_decoder_reset(&decoder);
+        decoded = 0;
+        errors = 0;
+
+        start_nsec = nsec_now();
+        start_cycles = cycles_now();
+
+        for ( offset = 0; offset < size; offset++ )
+        {
+            switch ( ibus_decode_byte(&decoder, stream[offset]) )
+            {
+                case IBUS_DECODE_FRAME:
+                    decoded++;
+                    break;
+
+                case IBUS_DECODE_ERROR:
+                    errors++;
+                    break;
+            }
+        }
+
+        start_cycles = cycles_now() - start_cycles;
+        start_nsec = nsec_now() - start_nsec;
+
+        if ( start_cycles < cycles )
+        {
+            cycles = start_cycles;
+        }
+        if ( start_nsec < nsec )
+        {
+            nsec = start_nsec;
+        }
+    }
+
+    printf("frames     %ld decoded, %ld errors, %zu bytes\n", decoded, errors, size);
+    printf("per byte   %.2f cycles, %.2f nSec\n", (double) cycles / size, (double) nsec / size);
+    printf("throughput %.1f MB/s, %.1f M frames/s\n", size * 1000.0 / nsec, decoded * 1000.0 / nsec);
+
+    free(stream);
+
+    return (decoded != frames || errors != 0);
+}
+
+/* ----------------------------------------------------------------------------
+ * check_frame()
+ *
+ *  Cross-check one reference frame against the codec.
+ *
+ *  return: '0'=frame ok, '1'=mismatch
+ *
+ */
+static int check_frame(const uint8_t *reference)
+{
+    ibus_decoder_t  decoder;
+    uint8_t         frame[IBUS_FRAME_MAX];
+    uint8_t         length, i, cmd, id;
+    int8_t          result;
+
+    length = reference[0];
+    cmd = ibus_frame_cmd(reference);
+    id = ibus_frame_id(reference);
+
+    /* Decode, the frame must complete at its last byte
+     */
+    ibus_decoder_reset(&decoder);
+    for ( i = 0; i < length; i++ )
+    {
+        result = ibus_decode_byte(&decoder, reference[i]);
+        if ( result != ((i == length - 1) ? IBUS_DECODE_FRAME : IBUS_DECODE_MORE) )
+        {
+            return 1;
+        }
+    }
+
+    if ( memcmp(decoder.frame, reference, length) != 0 )
+    {
+        return 1;
+    }
+
+    /* Encode in place
+     */
+    memcpy(ibus_frame_payload(frame), reference + 2, length - IBUS_FRAME_OVERHEAD);
+    if ( ibus_frame_finish(frame, cmd, id, length - IBUS_FRAME_OVERHEAD) != length ||
+         memcmp(frame, reference, length) != 0 )
+    {
+        return 1;
+    }
+
+    /* Frame initializer macros
+     */
+    if ( length == 4 )
+    {
+        uint8_t cmd_frame[] = IBUS_FRAME_CMD(cmd, id);
+
+        if ( memcmp(cmd_frame, reference, length) != 0 )
+        {
+            return 1;
+        }
+    }
+    else if ( length == 6 )
+    {
+        uint8_t u16_frame[] = IBUS_FRAME_U16(cmd, id, reference[2] | (reference[3] << 8));
+
+        if ( memcmp(u16_frame, reference, length) != 0 )
+        {
+            return 1;
+        }
+    }
+
+    /* Corrupted checksum must be rejected
+     */
+    ibus_decoder_reset(&decoder);
+    for ( i = 0; i < length - 1; i++ )
+    {
+        ibus_decode_byte(&decoder, reference[i]);
+    }
+
+    if ( ibus_decode_byte(&decoder, reference[length - 1] ^ 0x01) != IBUS_DECODE_ERROR )
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * check()
+ *
+ *  Cross-check a stream of reference frames from stdin.
+ *
+ */
+static int check(void)
+{
+    static uint8_t  buffer[CHECK_CHUNK + IBUS_FRAME_MAX];
+    size_t          size, offset, got;
+    long            frames[IBUS_FRAME_MAX + 1] = { 0 };
+    long            total, errors;
+    int             length;
+
+    total = 0;
+    errors = 0;
+    size = 0;
+
+    while ( (got = fread(buffer + size, 1, CHECK_CHUNK, stdin)) > 0 || size > 0 )
+    {
+        size += got;
+        offset = 0;
+
+        while ( offset < size )
+        {
+            length = buffer[offset];
+            if ( length < IBUS_FRAME_OVERHEAD || length > IBUS_FRAME_MAX )
+            {
+                fprintf(stderr, "bad reference frame length %d\n", length);
+                return 1;
+            }
+
+            if ( offset + length > size )
+            {
+                break;
+            }
+
+            if ( check_frame(buffer + offset) )
+            {
+                if ( errors < 10 )
+                {
+                    fprintf(stderr, "mismatch at frame %ld\n", total);
+                }
+                errors++;
+            }
+
+            frames[length]++;
+            total++;
+            offset += length;
+        }
+
+        if ( got == 0 && offset < size )
+        {
+            fprintf(stderr, "truncated reference stream\n");
+            return 1;
+        }
+
+        memmove(buffer, buffer + offset, size - offset);
+        size -= offset;
+    }
+
+    for ( length = IBUS_FRAME_OVERHEAD; length <= IBUS_FRAME_MAX; length += 2 )
+    {
+        printf("%d-byte frames %10ld\n", length, frames[length]);
+    }
+    printf("checked %ld frames, %ld mismatches\n", total, errors);
+
+    return (errors != 0 || total == 0);
+}
+
+/* ----------------------------------------------------------------------------
+ * main()
+ *
+ */
+int main(int argc, char *argv[])
+{
+    long    frames = BENCH_FRAMES;
+    int     i;
+
+    if ( read_cmd[2] != 0x5a || read_cmd[3] != 0xff )
+    {
+        fprintf(stderr, "constant frame checksum error\n");
+        return 1;
+    }
+
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( strcmp(argv[i], "--check") == 0 )
+        {
+            return check();
+        }
+        else if ( strcmp(argv[i], "-n") == 0 && i + 1 < argc )
+        {
+            frames = atol(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-n frames] | --check < frames\n", argv[0]);
+            return 1;
+        }
+    }
+
+    return bench(frames);
+}
@@ -0,0 +1,453 @@
+/*****************************************************************************
+* cycle_profile.c
+*
+*   AVR cycle profile of the sensor firmware's main paths under simavr.
+*
+*   The firmware ELF runs in the simavr core while a simulated receiver
+*   polls it over UART0 at the i.bus rate, and a fixed voltage is applied
+*   to ADC0. Every function given with '-f' is timed from its entry
+*   address to its return, detected by the stack pointer rising above its
+*   value at entry. For each function the program reports the call count
+*   and the cycles per call, including and excluding the interrupts that
+*   ran inside it (the 'net' column, interrupt handlers must be given
+*   with '-f' too). The response latency is measured from the receive
+*   interrupt of the last poll byte to the first response byte written
+*   to the UART.
+*
+*   Use 'make cycleprofile' from the project directory, which resolves
+*   the main path function addresses with cycle_profile.py, or:
+*     cc -O2 -I.. -I/usr/include/simavr -o cycle_profile cycle_profile.c -lsimavr -lelf
+*     ./cycle_profile -m atmega328p -c 10000000 [-s seconds] [-p poll_us] [-n sensors]
+*                     [-a adc0_mv] [-r aref_mv] [-x rx_vector] -f name=address ... firmware.elf
+*
+*   Emulation differences to the hardware:
+*     - simavr does not start a conversion on entering ADC noise reduction
+*       sleep, the program sets ADSC before the 'sleep' instruction instead.
+*     - simavr does not stop the timers in ADC noise reduction sleep, the
+*       firmware's halted time correction runs the time base slightly fast.
+*     - A poll byte arriving during a conversion is received, on the
+*       hardware it is lost.
+*     - An interrupt taken right after a 'ret' is counted in the returning
+*       function, the error is a few cycles.
+*
+*****************************************************************************/
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    <sim_avr.h>
+#include    <sim_core.h>
+#include    <sim_elf.h>
+#include    <sim_io.h>
+#include    <sim_irq.h>
+#include    <sim_time.h>
+#include    <sim_cycle_timers.h>
+#include    <avr_uart.h>
+#include    <avr_adc.h>
+
+#include    "ibus_codec.h"
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     MAX_FUNCTIONS       64
+
+#define     OPCODE_SLEEP        0x9588
+#define     REG_SMCR            0x53        // Data space addresses, ATmega88P to 1284P
+#define     REG_ADCSRA          0x7a
+#define     SMCR_SM_MASK        0x0e
+#define     SMCR_SM_ADC         0x02        // ADC noise reduction sleep
+#define     ADCSRA_ADEN         0x80
+#define     ADCSRA_ADSC         0x40
+
+typedef struct {
+    char                name[48];
+    uint32_t            address;            // Byte address in flash
+    int                 active;
+    uint16_t            entry_sp;
+    avr_cycle_count_t   entry_cycle;
+    avr_cycle_count_t   entry_isr;
+    uint32_t            calls;
+    avr_cycle_count_t   total;
+    avr_cycle_count_t   min;
+    avr_cycle_count_t   max;
+    avr_cycle_count_t   net_max;
+    int                 isr;                // Interrupt handler, '__vector_*'
+} function_t;
+
+typedef struct {
+    avr_t              *avr;
+    avr_irq_t          *uart_in;
+    uint32_t            poll_us;
+    int                 sensors;
+    uint32_t            polls;
+    int                 rx_count;           // Receive interrupts since the last poll
+    int                 awaiting;           // Poll received, no response byte yet
+    avr_cycle_count_t   rx_last;
+    uint32_t            responses;
+    avr_cycle_count_t   latency_total;
+    avr_cycle_count_t   latency_min;
+    avr_cycle_count_t   latency_max;
+} receiver_t;
+
+/****************************************************************************
+  Globals
+****************************************************************************/
+static function_t       functions[MAX_FUNCTIONS];
+static int              function_count = 0;
+static uint8_t         *function_at;        // Function index + 1 per flash byte address
+static avr_cycle_count_t isr_cycles = 0;    // Cycles spent in profiled interrupt handlers
+static receiver_t       receiver;
+
+/* ----------------------------------------------------------------------------
+ * stack_pointer()
+ *
+ */
+static uint16_t stack_pointer(avr_t *avr)
+{
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+/* ----------------------------------------------------------------------------
+ * poll_timer()
+ *
+ *  Simulated receiver, one command frame per poll interval. The sensors
+ *  are discovered, their types read, and then they are read in turn.
+ *
+ */
+static avr_cycle_count_t poll_timer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+    receiver_t *rx = (receiver_t *) param;
+    uint8_t     frame[IBUS_FRAME_MAX], cmd, id, length, i;
+
+    id = (rx->polls % rx->sensors) + 1;
+
+    if ( rx->polls < (uint32_t) rx->sensors )
+        cmd = IBUS_CMD_DISCOVER;
+    else if ( rx->polls < (uint32_t)(2 * rx->sensors) )
+        cmd = IBUS_CMD_SENSOR_TYPE;
+    else
+        cmd = IBUS_CMD_SENSOR_READ;
+
+    length = ibus_frame_finish(frame, cmd, id, 0);
+
+    for ( i = 0; i < length; i++ )
+    {
+        avr_raise_irq(rx->uart_in, frame[i]);
+    }
+
+    rx->polls++;
+    rx->rx_count = 0;
+    rx->awaiting = 0;
+
+    return when + avr_usec_to_cycles(avr, rx->poll_us);
+}
+
+/* ----------------------------------------------------------------------------
+ * uart_output()
+ *
+ *  Response byte written to the UART by the firmware.
+ *
+ */
+static void uart_output(avr_irq_t *irq, uint32_t value, void *param)
+{
+    receiver_t         *rx = (receiver_t *) param;
+    avr_cycle_count_t   latency;
+
+    if ( !rx->awaiting )
+        return;
+
+    rx->awaiting = 0;
+    latency = rx->avr->cycle - rx->rx_last;
+
+    if ( rx->responses == 0 || latency < rx->latency_min )
+        rx->latency_min = latency;
+    if ( latency > rx->latency_max )
+        rx->latency_max = latency;
+
+    rx->latency_total += latency;
+    rx->responses++;
+}
+
+/* ----------------------------------------------------------------------------
+ * function_entry()
+ *
+ *  Start timing a function when the CPU is at its first instruction.
+ *
+ */
+static void function_entry(avr_t *avr, function_t *function, const char *rx_vector)
+{
+    if ( function->active )
+        return;
+
+    function->active = 1;
+    function->entry_sp = stack_pointer(avr);
+    function->entry_cycle = avr->cycle;
+    function->entry_isr = isr_cycles;
+
+    /* Poll frames are commands without data
+     */
+    if ( strcmp(function->name, rx_vector) == 0 && ++receiver.rx_count == IBUS_FRAME_OVERHEAD )
+    {
+        receiver.rx_last = avr->cycle;
+        receiver.awaiting = 1;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * function_exits()
+ *
+ *  Stop timing the functions that returned, their stack pointer is
+ *  above its value at entry.
+ *
+ */
+static void function_exits(avr_t *avr)
+{
+    function_t         *function;
+    avr_cycle_count_t   cycles, net;
+    uint16_t            sp;
+    int                 i;
+
+    sp = stack_pointer(avr);
+
+    for ( i = 0; i < function_count; i++ )
+    {
+        function = &functions[i];
+
+        if ( !function->active || sp <= function->entry_sp )
+            continue;
+
+        function->active = 0;
+        cycles = avr->cycle - function->entry_cycle;
+        net = cycles - (isr_cycles - function->entry_isr);
+
+        if ( function->calls == 0 || cycles < function->min )
+            function->min = cycles;
+        if ( cycles > function->max )
+            function->max = cycles;
+        if ( net > function->net_max )
+            function->net_max = net;
+
+        function->total += cycles;
+        function->calls++;
+
+        if ( function->isr )
+            isr_cycles += cycles;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * adc_sleep_start()
+ *
+ *  Start the ADC conversion that the hardware starts on entering
+ *  ADC noise reduction sleep.
+ *
+ */
+static void adc_sleep_start(avr_t *avr)
+{
+    uint16_t    opcode;
+    uint8_t     adcsra;
+
+    opcode = avr->flash[avr->pc] | (avr->flash[avr->pc + 1] << 8);
+    adcsra = avr->data[REG_ADCSRA];
+
+    if ( opcode == OPCODE_SLEEP &&
+         (avr->data[REG_SMCR] & SMCR_SM_MASK) == SMCR_SM_ADC &&
+         (adcsra & ADCSRA_ADEN) && !(adcsra & ADCSRA_ADSC) )
+    {
+        avr_core_watch_write(avr, REG_ADCSRA, adcsra | ADCSRA_ADSC);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * usage()
+ *
+ */
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s -m mcu -c hz [-s seconds] [-p poll_us] [-n sensors] [-a adc0_mv] [-r aref_mv]\n"
+                    "       [-x rx_vector] -f name=address ... firmware.elf\n", name);
+    exit(2);
+}
+
+/* ----------------------------------------------------------------------------
+ * main()
+ *
+ */
+int main(int argc, char *argv[])
+{
+    elf_firmware_t      firmware;
+    avr_t              *avr;
+    avr_cycle_count_t   end;
+    const char         *mcu = NULL, *elf = NULL, *rx_vector = "__vector_18";
+    char               *eq;
+    uint32_t            hz = 0, adc0_mv = 1950, aref_mv = 3300, flags;
+    float               seconds = 5.0f;
+    function_t         *function;
+    int                 i, index, state;
+
+    receiver.poll_us = 7700;
+    receiver.sensors = 1;
+
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( argv[i][0] != '-' )
+            elf = argv[i];
+        else if ( (i + 1) >= argc )
+            usage(argv[0]);
+        else if ( strcmp(argv[i], "-m") == 0 )
+            mcu = argv[++i];
+        else if ( strcmp(argv[i], "-c") == 0 )
+            hz = strtoul(argv[++i], NULL, 0);
+        else if ( strcmp(argv[i], "-s") == 0 )
+            seconds = strtof(argv[++i], NULL);
+        else if ( strcmp(argv[i], "-p") == 0 )
+            receiver.poll_us = strtoul(argv[++i], NULL, 0);
+        else if ( strcmp(argv[i], "-n") == 0 )
+            receiver.sensors = atoi(argv[++i]);
+        else if ( strcmp(argv[i], "-a") == 0 )
+            adc0_mv = strtoul(argv[++i], NULL, 0);
+        else if ( strcmp(argv[i], "-r") == 0 )
+            aref_mv = strtoul(argv[++i], NULL, 0);
+        else if ( strcmp(argv[i], "-x") == 0 )
+            rx_vector = argv[++i];
+        else if ( strcmp(argv[i], "-f") == 0 && function_count < MAX_FUNCTIONS )
+        {
+            function = &functions[function_count++];
+            eq = strchr(argv[++i], '=');
+
+            if ( eq == NULL )
+                usage(argv[0]);
+
+            *eq = '\0';
+            snprintf(function->name, sizeof(function->name), "%s", argv[i]);
+            function->address = strtoul(eq + 1, NULL, 0);
+            function->isr = (strncmp(function->name, "__vector_", 9) == 0);
+        }
+        else
+            usage(argv[0]);
+    }
+
+    if ( mcu == NULL || hz == 0 || elf == NULL || receiver.sensors < 1 )
+        usage(argv[0]);
+
+    /* Load the firmware
+     */
+    memset(&firmware, 0, sizeof(firmware));
+
+    if ( elf_read_firmware(elf, &firmware) != 0 )
+    {
+        fprintf(stderr, "%s: can not read firmware\n", elf);
+        return 1;
+    }
+
+    snprintf(firmware.mmcu, sizeof(firmware.mmcu), "%s", mcu);
+    firmware.frequency = hz;
+    firmware.vcc = 5000;
+    firmware.avcc = 5000;
+    firmware.aref = aref_mv;
+
+    if ( (avr = avr_make_mcu_by_name(mcu)) == NULL )
+    {
+        fprintf(stderr, "%s: MCU not supported by simavr\n", mcu);
+        return 1;
+    }
+
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+
+    function_at = calloc(avr->flashend + 1, 1);
+
+    if ( function_at == NULL )
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for ( i = 0; i < function_count; i++ )
+    {
+        if ( functions[i].address <= avr->flashend )
+            function_at[functions[i].address] = i + 1;
+    }
+
+    /* Receiver on UART0, response bytes are not echoed to stdout
+     */
+    flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+    receiver.avr = avr;
+    receiver.uart_in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+                            uart_output, &receiver);
+    avr_cycle_timer_register_usec(avr, receiver.poll_us, poll_timer, &receiver);
+
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0), adc0_mv);
+
+    /* Run one instruction at a time
+     */
+    end = avr_usec_to_cycles(avr, (uint32_t)(seconds * 1000000.0f));
+
+    while ( avr->cycle < end )
+    {
+        adc_sleep_start(avr);
+
+        if ( (index = function_at[avr->pc]) )
+            function_entry(avr, &functions[index - 1], rx_vector);
+
+        state = avr_run(avr);
+        function_exits(avr);
+
+        if ( state == cpu_Done || state == cpu_Crashed )
+        {
+            fprintf(stderr, "firmware stopped at 0x%04x, cycle %llu\n",
+                    avr->pc, (unsigned long long) avr->cycle);
+            return 1;
+        }
+    }
+
+    /* Report
+     */
+    printf("cycle profile, %s at %u Hz, %.1f sec emulated, %u polls every %u uSec\n",
+           mcu, hz, seconds, receiver.polls, receiver.poll_us);
+    printf("function                    calls      min      avg      max  max net  max uSec\n");
+
+    for ( i = 0; i < function_count; i++ )
+    {
+        function = &functions[i];
+
+        if ( function->calls == 0 )
+        {
+            printf("%-24s %8u  not called\n", function->name, 0);
+            continue;
+        }
+
+        printf("%-24s %8u %8llu %8llu %8llu %8llu %9.1f\n",
+               function->name, function->calls,
+               (unsigned long long) function->min,
+               (unsigned long long)(function->total / function->calls),
+               (unsigned long long) function->max,
+               (unsigned long long) function->net_max,
+               function->max * 1000000.0 / hz);
+    }
+
+    if ( receiver.responses )
+    {
+        printf("response latency, last poll byte to first response byte: %u responses, "
+               "min %llu, avg %llu, max %llu cycles, max %.1f uSec\n",
+               receiver.responses,
+               (unsigned long long) receiver.latency_min,
+               (unsigned long long)(receiver.latency_total / receiver.responses),
+               (unsigned long long) receiver.latency_max,
+               receiver.latency_max * 1000000.0 / hz);
+    }
+    else
+    {
+        printf("response latency: no responses\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#!/usr/bin/python3
+#####################################################################
+#
+# cycle_profile.py
+#
+#   AVR cycle profile of the sensor firmware's main paths under simavr.
+#   Resolves the addresses of the main path functions and of every
+#   interrupt handler in the ELF with avr-nm, and runs the simavr
+#   profiler program (cycle_profile.c) on them.
+#
+#   Main paths:
+#     ADC scan       - task_adc, adc_convert and the ADC interrupt
+#     response path  - UART receive interrupt, sensor value and the
+#                      frame encoding and transmission
+#     background     - scheduler dispatch and the flight log task
+#
+#   Functions that are not in the build, inlined or disabled by the
+#   configuration, are listed and skipped.
+#
+#   python3 cycle_profile.py --profiler <program> --elf <elf> --mcu <mcu> --freq <hz>
+#                            [--nm <prog>] [--seconds s] [--poll-us us] [--sensors n]
+#                            [--adc0-mv mv] [--aref-mv mv] [--function name ...]
+#
+#####################################################################
+
+import argparse
+import subprocess
+import sys
+
+MAIN_PATHS = (
+    'sched_dispatch',
+    'task_adc',
+    'adc_convert',
+    'task_fuel',
+    'task_log',
+    'get_sensor_value',
+    'ibus_get_packet',
+    'ibus_send_ack',
+    'ibus_send_u16',
+)
+
+VECTOR_PREFIX = '__vector_'
+
+# UART receive interrupt vector per MCU
+RX_VECTORS = {
+    'atmega88p':   '__vector_18',
+    'atmega168p':  '__vector_18',
+    'atmega328p':  '__vector_18',
+    'atmega1284p': '__vector_20',
+}
+
+
+
+def function_addresses(nm, elf):
+    '''
+    Text symbol addresses from the ELF.
+    Returns a dictionary of function name to byte address.
+    '''
+    addresses = {}
+    output = subprocess.run([nm, '--defined-only', elf], capture_output=True, text=True, check=True).stdout
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in ('T', 't'):
+            addresses[fields[2]] = int(fields[0], 16)
+    return addresses
+
+def main():
+    parser = argparse.ArgumentParser(description='AVR cycle profile of the main paths under simavr')
+    parser.add_argument('--profiler', required=True, help='simavr profiler program')
+    parser.add_argument('--elf', required=True, help='linked ELF file')
+    parser.add_argument('--mcu', required=True, choices=sorted(RX_VECTORS), help='MCU name')
+    parser.add_argument('--freq', required=True, help='MCU clock in Hz, a UL suffix is ignored')
+    parser.add_argument('--nm', default='avr-nm', help='nm program')
+    parser.add_argument('--seconds', type=float, default=5.0, help='emulated run time')
+    parser.add_argument('--poll-us', type=int, default=7700, help='receiver poll interval')
+    parser.add_argument('--sensors', type=int, default=1, help='sensor IDs the receiver polls')
+    parser.add_argument('--adc0-mv', type=int, default=1950, help='ADC0 input, 11.1v pack through 5.7:1')
+    parser.add_argument('--aref-mv', type=int, default=3300, help='external ADC reference')
+    parser.add_argument('--function', nargs='*', default=[], help='more functions to profile')
+    args = parser.parse_args()
+
+    addresses = function_addresses(args.nm, args.elf)
+    names = list(MAIN_PATHS) + args.function
+    names += sorted(f for f in addresses if f.startswith(VECTOR_PREFIX))
+
+    missing = [name for name in names if name not in addresses]
+    if missing:
+        print('not in the build: ' + ', '.join(missing))
+
+    command = [args.profiler,
+               '-m', args.mcu,
+               '-c', args.freq.rstrip('UuLl'),
+               '-s', str(args.seconds),
+               '-p', str(args.poll_us),
+               '-n', str(args.sensors),
+               '-a', str(args.adc0_mv),
+               '-r', str(args.aref_mv),
+               '-x', RX_VECTORS[args.mcu]]
+    for name in names:
+        if name in addresses:
+            command += ['-f', '{}=0x{:x}'.format(name, addresses[name])]
+    command.append(args.elf)
+
+    sys.exit(subprocess.run(command).returncode)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,588 @@
+/*****************************************************************************
+* filter_bench.c
+*
+*   Host benchmark of the voltage sensor ADC filter, voltage conversion
+*   and battery percent estimators.
+*   Pack voltage traces, synthetic or recorded, are converted to ADC readouts
+*   the way the sensor hardware does (5.7:1 divider, 3.3v reference, 8-bit
+*   left adjusted readout) and replayed through the firmware's own filter
+*   and battery code (../adc_filter.h, ../battery.c).
+*   For every filter type and length the benchmark reports:
+*     delay      - group delay at DC, analytic, and the 50% and 90% points
+*                  of a noise-free step response, measured once per filter
+*     overshoot  - worst excursion outside the trace's recent voltage range
+*     error      - voltage and percent error against a floating point reference
+*
+*   Each filter is scored after the firmware start up delay or its own
+*   settling time from a zero state, whichever is longer.
+*   No execution cost is reported, the AVR cycles of the filters are not
+*   measured by this host program.
+*
+*   Build and run with 'make bench' from the project directory, or:
+*     cc -O2 -I.. -o filter_bench filter_bench.c ../battery.c -lm
+*     ./filter_bench [-n noise_lsb] [-s seed] [trace.csv ...]
+*
+*   A trace file holds one sample per line, either 'volts' sampled at the
+*   ADC rate or 'seconds,volts' which is resampled to the ADC rate.
+*
+*****************************************************************************/
+
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <stdint.h>
+#include    <string.h>
+#include    <math.h>
+
+#include    "adc_filter.h"
+#include    "battery.h"
+
+/****************************************************************************
+  Definitions
+****************************************************************************/
+#define     ADC_INTERVAL_MS     26
+#define     SAMPLE_RATE         (1000.0 / ADC_INTERVAL_MS)  // Timer0 mSec time base ADC trigger
+#define     STARTUP_SKIP        (2.0 * SAMPLE_RATE)         // Firmware STARTUP_DELAY
+#define     EMA_SETTLE_EFOLDS   6                           // Zero state to within 1 LSB of 255
+#define     ENVELOPE_WINDOW     ((int)(2.0 * SAMPLE_RATE))  // Overshoot reference window
+#define     STEP_LOW            128                         // Step response ADCH levels
+#define     STEP_HIGH           192
+#define     MAX_TRACES          16
+
+typedef struct {
+    char        name[64];
+    int         count;
+    float      *volts;
+} trace_t;
+
+typedef struct {
+    int         type;
+    int         bits;
+} filter_opt_t;
+
+typedef struct {
+    float       overshoot_mv;
+    float       v_rms_mv;
+    float       v_max_mv;
+    float       step_rms;
+    float       step_max;
+    float       interp_rms;
+    float       interp_max;
+} result_t;
+
+/****************************************************************************
+  Globals
+****************************************************************************/
+static uint32_t         rand_state = 12345;
+
+/* ----------------------------------------------------------------------------
+ * gaussian()
+ *
+ *  Repeatable normal distributed noise, xorshift32 and Box-Muller.
+ *
+ */
+static float gaussian(void)
+{
+    float       u1, u2;
+
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    u1 = ((rand_state >> 8) + 1.0f) / 16777217.0f;
+
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    u2 = (rand_state >> 8) / 16777216.0f;
+
+    return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float) M_PI * u2);
+}
+
+/* ----------------------------------------------------------------------------
+ * trace_alloc()
+ *
+ */
+static trace_t *trace_alloc(trace_t *trace, const char *name, float seconds)
+{
+    snprintf(trace->name, sizeof(trace->name), "%s", name);
+    trace->count = (int)(seconds * SAMPLE_RATE);
+    trace->volts = calloc(trace->count, sizeof(float));
+
+    if ( trace->volts == NULL )
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    return trace;
+}
+
+/* ----------------------------------------------------------------------------
+ * Synthetic traces
+ *
+ *  cruise    - 3S pack at part throttle slowly discharging with throttle ripple
+ *  punch-out - 3S pack with repeated 2 second full throttle punches
+ *  landing   - 4S pack under load, throttle cut and pack recovery at rest
+ *
+ */
+static void trace_cruise(trace_t *trace)
+{
+    int         i;
+    float       t;
+
+    trace_alloc(trace, "cruise", 240.0f);
+
+    for ( i = 0; i < trace->count; i++ )
+    {
+        t = i / SAMPLE_RATE;
+        trace->volts[i] = 12.10f - 0.80f * (t / 240.0f) + 0.05f * sinf(2.0f * (float) M_PI * 0.5f * t);
+    }
+}
+
+static void trace_punch_out(trace_t *trace)
+{
+    int         i;
+    float       t, rest;
+
+    trace_alloc(trace, "punch-out", 60.0f);
+
+    for ( i = 0; i < trace->count; i++ )
+    {
+        t = i / SAMPLE_RATE;
+        rest = 11.90f - 0.20f * (t / 60.0f);
+        trace->volts[i] = rest;
+
+        if ( fmodf(t, 10.0f) >= 5.0f && fmodf(t, 10.0f) < 7.0f )
+        {
+            trace->volts[i] -= 0.90f;
+        }
+    }
+}
+
+static void trace_landing(trace_t *trace)
+{
+    int         i;
+    float       t;
+
+    trace_alloc(trace, "landing", 60.0f);
+
+    for ( i = 0; i < trace->count; i++ )
+    {
+        t = i / SAMPLE_RATE;
+
+        if ( t < 30.0f )
+        {
+            trace->volts[i] = 14.90f - 0.30f * (t / 30.0f);
+        }
+        else
+        {
+            trace->volts[i] = 15.20f + 0.10f * (1.0f - expf(-(t - 30.0f) / 8.0f));
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * trace_load()
+ *
+ *  Load a trace file. Lines are 'volts' or 'seconds,volts'.
+ *
+ */
+static int trace_load(trace_t *trace, const char *file_name)
+{
+    FILE       *file;
+    char        line[128];
+    float       *t = NULL, *v = NULL, *grow, a, b, now;
+    int         n = 0, size = 0, i, j, timed = 0;
+
+    if ( (file = fopen(file_name, "r")) == NULL )
+    {
+        perror(file_name);
+        return 0;
+    }
+
+    while ( fgets(line, sizeof(line), file) )
+    {
+        int fields = sscanf(line, "%f,%f", &a, &b);
+
+        if ( fields < 1 )
+            continue;
+
+        if ( n == size )
+        {
+            size = size ? 2 * size : 1024;
+
+            if ( (grow = realloc(t, size * sizeof(float))) == NULL )
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            t = grow;
+
+            if ( (grow = realloc(v, size * sizeof(float))) == NULL )
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            v = grow;
+        }
+
+        timed = (fields == 2);
+        t[n] = timed ? a : n / SAMPLE_RATE;
+        v[n] = timed ? b : a;
+        n++;
+    }
+
+    fclose(file);
+
+    if ( n < 2 )
+    {
+        fprintf(stderr, "%s: not enough samples\n", file_name);
+        free(t);
+        free(v);
+        return 0;
+    }
+
+    /* Resample to the ADC rate with linear interpolation
+     */
+    trace_alloc(trace, file_name, t[n - 1] - t[0]);
+
+    for ( i = 0, j = 0; i < trace->count; i++ )
+    {
+        now = t[0] + i / SAMPLE_RATE;
+
+        while ( j < (n - 2) && t[j + 1] < now )
+            j++;
+
+        trace->volts[i] = v[j] + (v[j + 1] - v[j]) * (now - t[j]) / (t[j + 1] - t[j]);
+    }
+
+    free(t);
+    free(v);
+
+    return 1;
+}
+
+/* ----------------------------------------------------------------------------
+ * adc_readouts()
+ *
+ *  Model the sensor front end: divider, reference, 10-bit ADC with
+ *  noise in LSB, and the 8-bit left adjusted ADCH readout.
+ *
+ */
+static void adc_readouts(const trace_t *trace, uint8_t *adch, float noise_lsb)
+{
+    int         i;
+    float       counts;
+
+    for ( i = 0; i < trace->count; i++ )
+    {
+        counts = trace->volts[i] * 100.0f / (BATT_DIVIDER * ADC_VREF) * 1024.0f;
+        counts += noise_lsb * gaussian();
+
+        if ( counts < 0.0f )
+            counts = 0.0f;
+        if ( counts > 1023.0f )
+            counts = 1023.0f;
+
+        adch[i] = ((uint16_t) counts) >> 2;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * reference_percent()
+ *
+ *  Floating point battery percent, interpolated on the capacity table.
+ *
+ */
+static float reference_percent(float volts)
+{
+    int         x, size;
+    float       centi = volts * 100.0f, low, high;
+
+    size = battery_size((uint16_t)(centi + 0.5f));
+
+    if ( size == -1 )
+    {
+        return (centi > battery_capacity[0][0]) ? 100.0f : 0.0f;
+    }
+
+    for ( x = 0; x < (BATT_PERCENTS - 1); x++ )
+    {
+        low = battery_capacity[x][size];
+        high = battery_capacity[(x + 1)][size];
+
+        if ( centi <= high )
+        {
+            return x * BATT_PERCENT_STEP + BATT_PERCENT_STEP * (centi - low) / (high - low);
+        }
+    }
+
+    return 100.0f;
+}
+
+/* ----------------------------------------------------------------------------
+ * run_filter()
+ *
+ *  Replay ADC readouts through one filter option.
+ *
+ */
+static void run_filter(const filter_opt_t *opt, const uint8_t *adch, uint8_t *out, int count)
+{
+    adc_boxcar_t    boxcar;
+    adc_ema_t       ema;
+    int             i;
+
+    memset(&boxcar, 0, sizeof(boxcar));
+    memset(&ema, 0, sizeof(ema));
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( opt->type == ADC_FILTER_BOXCAR )
+            out[i] = adc_boxcar_update(&boxcar, adch[i], opt->bits);
+        else
+            out[i] = adc_ema_update(&ema, adch[i], opt->bits);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * filter_settle()
+ *
+ *  Samples until a filter started from a zero state tracks its input:
+ *  the buffer length for the moving average, EMA_SETTLE_EFOLDS e-folds
+ *  for the exponential filter.
+ *
+ */
+static int filter_settle(const filter_opt_t *opt)
+{
+    if ( opt->type == ADC_FILTER_BOXCAR )
+        return (1 << opt->bits);
+
+    return EMA_SETTLE_EFOLDS * (1 << opt->bits);
+}
+
+/* ----------------------------------------------------------------------------
+ * group_delay()
+ *
+ *  Analytic group delay at DC in samples: (N - 1) / 2 for the moving
+ *  average of N samples, N - 1 for the exponential filter with
+ *  alpha = 1/N. This is the lag of the filter output behind a slow ramp.
+ *
+ */
+static float group_delay(const filter_opt_t *opt)
+{
+    if ( opt->type == ADC_FILTER_BOXCAR )
+        return ((1 << opt->bits) - 1) / 2.0f;
+
+    return (float)((1 << opt->bits) - 1);
+}
+
+/* ----------------------------------------------------------------------------
+ * step_response()
+ *
+ *  Noise-free step from STEP_LOW to STEP_HIGH through a settled filter.
+ *  Returns the samples after the step, the step sample being 0, until the
+ *  output first reaches 50% and 90% of the step.
+ *
+ */
+static void step_response(const filter_opt_t *opt, int *at50, int *at90)
+{
+    uint8_t    *adch, *out;
+    int         settle, count, i;
+
+    settle = 2 * filter_settle(opt);
+    count = settle + 4 * filter_settle(opt);
+    adch = malloc(count);
+    out = malloc(count);
+
+    if ( adch == NULL || out == NULL )
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        adch[i] = (i < settle) ? STEP_LOW : STEP_HIGH;
+    }
+
+    run_filter(opt, adch, out, count);
+
+    *at50 = *at90 = -1;
+    for ( i = settle; i < count; i++ )
+    {
+        if ( *at50 < 0 && 2 * (out[i] - STEP_LOW) >= (STEP_HIGH - STEP_LOW) )
+            *at50 = i - settle;
+        if ( *at90 < 0 && 10 * (out[i] - STEP_LOW) >= 9 * (STEP_HIGH - STEP_LOW) )
+            *at90 = i - settle;
+    }
+
+    free(adch);
+    free(out);
+}
+
+/* ----------------------------------------------------------------------------
+ * evaluate()
+ *
+ */
+static void evaluate(const trace_t *trace, const filter_opt_t *opt, const uint8_t *adch, result_t *result)
+{
+    uint8_t    *filtered;
+    float      *volts, err, env_min, env_max, excursion, ref_pct;
+    int         i, j, start, n;
+
+    filtered = malloc(trace->count);
+    volts = malloc(trace->count * sizeof(float));
+
+    run_filter(opt, adch, filtered, trace->count);
+
+    for ( i = 0; i < trace->count; i++ )
+    {
+        volts[i] = battery_voltage(filtered[i]) / 100.0f;
+    }
+
+    start = (int) STARTUP_SKIP;
+    if ( filter_settle(opt) > start )
+    {
+        start = filter_settle(opt);
+    }
+
+    memset(result, 0, sizeof(*result));
+
+    /* Overshoot, voltage and percent errors
+     */
+    n = 0;
+
+    for ( i = start; i < trace->count; i++ )
+    {
+        env_min = env_max = trace->volts[i];
+        for ( j = i - ENVELOPE_WINDOW; j < i; j++ )
+        {
+            if ( trace->volts[j] < env_min )
+                env_min = trace->volts[j];
+            if ( trace->volts[j] > env_max )
+                env_max = trace->volts[j];
+        }
+
+        excursion = fmaxf(volts[i] - env_max, env_min - volts[i]) * 1000.0f;
+        result->overshoot_mv = fmaxf(result->overshoot_mv, excursion);
+
+        err = fabsf(volts[i] - trace->volts[i]) * 1000.0f;
+        result->v_rms_mv += err * err;
+        result->v_max_mv = fmaxf(result->v_max_mv, err);
+
+        ref_pct = reference_percent(trace->volts[i]);
+
+        err = fabsf(battery_percent(battery_voltage(filtered[i])) - ref_pct);
+        result->step_rms += err * err;
+        result->step_max = fmaxf(result->step_max, err);
+
+        err = fabsf(battery_percent_interpolated(battery_voltage(filtered[i])) - ref_pct);
+        result->interp_rms += err * err;
+        result->interp_max = fmaxf(result->interp_max, err);
+
+        n++;
+    }
+
+    if ( n )
+    {
+        result->v_rms_mv = sqrtf(result->v_rms_mv / n);
+        result->step_rms = sqrtf(result->step_rms / n);
+        result->interp_rms = sqrtf(result->interp_rms / n);
+    }
+
+    free(filtered);
+    free(volts);
+}
+
+/* ----------------------------------------------------------------------------
+ * main()
+ *
+ */
+int main(int argc, char *argv[])
+{
+    trace_t         traces[MAX_TRACES];
+    filter_opt_t    options[2 * ADC_AVERAGE_MAX_BITS];
+    result_t        result;
+    uint8_t        *adch;
+    float           noise_lsb = 1.0f;
+    int             trace_count = 0, option_count = 0, i, t, bits, at50, at90;
+
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( strcmp(argv[i], "-n") == 0 && (i + 1) < argc )
+        {
+            noise_lsb = strtof(argv[++i], NULL);
+        }
+        else if ( strcmp(argv[i], "-s") == 0 && (i + 1) < argc )
+        {
+            rand_state = strtoul(argv[++i], NULL, 0) | 1;
+        }
+        else if ( trace_count < MAX_TRACES )
+        {
+            trace_count += trace_load(&traces[trace_count], argv[i]);
+        }
+    }
+
+    if ( trace_count == 0 )
+    {
+        trace_cruise(&traces[trace_count++]);
+        trace_punch_out(&traces[trace_count++]);
+        trace_landing(&traces[trace_count++]);
+    }
+
+    for ( bits = 1; bits <= ADC_AVERAGE_MAX_BITS; bits++ )
+    {
+        options[option_count].type = ADC_FILTER_BOXCAR;
+        options[option_count++].bits = bits;
+    }
+
+    for ( bits = 1; bits <= ADC_AVERAGE_MAX_BITS; bits++ )
+    {
+        options[option_count].type = ADC_FILTER_EMA;
+        options[option_count++].bits = bits;
+    }
+
+    printf("ADC rate %.2f Hz, noise %.2f LSB (10-bit)\n", SAMPLE_RATE, noise_lsb);
+
+    printf("\nfilter delay, group delay at DC and noise-free step response\n");
+    printf("filter   group delay  step 50%%  step 90%%\n");
+    printf("                [mS]      [mS]      [mS]\n");
+
+    for ( i = 0; i < option_count; i++ )
+    {
+        step_response(&options[i], &at50, &at90);
+
+        printf("%-6s/%-2d %11.0f %9.0f %9.0f\n",
+               options[i].type == ADC_FILTER_BOXCAR ? "boxcar" : "ema",
+               1 << options[i].bits,
+               group_delay(&options[i]) * 1000.0f / SAMPLE_RATE,
+               at50 * 1000.0f / SAMPLE_RATE, at90 * 1000.0f / SAMPLE_RATE);
+    }
+
+    for ( t = 0; t < trace_count; t++ )
+    {
+        adch = malloc(traces[t].count);
+        adc_readouts(&traces[t], adch, noise_lsb);
+
+        printf("\ntrace: %s (%d samples, %.1f sec)\n", traces[t].name, traces[t].count, traces[t].count / SAMPLE_RATE);
+        printf("filter   overshoot    V rms    V max   step%% rms   max  interp%% rms   max\n");
+        printf("              [mV]     [mV]     [mV]\n");
+
+        for ( i = 0; i < option_count; i++ )
+        {
+            evaluate(&traces[t], &options[i], adch, &result);
+
+            printf("%-6s/%-2d %9.0f %8.0f %8.0f %11.2f %5.1f %12.2f %5.1f\n",
+                   options[i].type == ADC_FILTER_BOXCAR ? "boxcar" : "ema",
+                   1 << options[i].bits,
+                   result.overshoot_mv,
+                   result.v_rms_mv, result.v_max_mv,
+                   result.step_rms, result.step_max,
+                   result.interp_rms, result.interp_max);
+        }
+
+        free(adch);
+        free(traces[t].volts);
+    }
+
+    return 0;
+}
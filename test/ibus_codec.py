@@ -0,0 +1,75 @@
+#####################################################################
+#
+# ibus_codec.py
+#
+#   i.BUS frame building and parsing for the host test programs,
+#   the Python reference of the firmware codec in ../ibus_codec.h
+#
+#   Frame: length, command << 4 | sensor ID, data, checksum low, checksum high
+#   The checksum is 65535 less the sum of all bytes before it.
+#
+#####################################################################
+
+IBUS_CMD_DISCOVER = 8
+IBUS_CMD_SENSOR_TYPE = 9
+IBUS_CMD_SENSOR_READ = 10
+
+
+
+def build_packet(command, sensor_id, *data_bytes):
+    '''
+    Build an i.bus packet.
+    The function calculates packet length and checksum.
+    '''
+    packet_length = 4 + len(data_bytes)
+    cmd_sensor = (command << 4) + sensor_id
+    checksum = packet_length + cmd_sensor
+    for byte in data_bytes:
+        checksum = checksum + byte
+
+    checksum = 65535 - checksum
+
+    packet = bytearray([packet_length, cmd_sensor])
+    for byte in data_bytes:
+        packet.append(byte)
+
+    packet.append(checksum & 255)
+    packet.append(checksum >> 8)
+
+    return packet
+
+def get_packet(serial_in):
+    '''
+    Get a RC receiver data packet from the serial link.
+    Returns packet length as integer and byte list packet data
+    without packet length byte.
+    '''
+    packet_length = int.from_bytes(serial_in.read(1),'little')
+    resp = serial_in.read((packet_length)-1)
+
+    return (packet_length, resp)
+
+def parse_packet(length, data):
+    '''
+    Parse RC receiver packet and return command, sensor ID and validity of checksum
+    '''
+    # Calculate checksum
+    checksum = length
+    for byte in range(length-3):
+        checksum = checksum + data[byte]
+
+    checksum = 65535 - checksum
+
+    # Check checksum validity
+    packet_checksum = int.from_bytes(data[-2:],'little')
+    if packet_checksum != checksum:
+        valid_checksum = False
+    else:
+        valid_checksum = True
+
+    # Command byte
+    cmd_sensor = data[0]
+    command = cmd_sensor >> 4
+    sensor = cmd_sensor & 15
+
+    return command, sensor, valid_checksum
@@ -0,0 +1,185 @@
+#!/usr/bin/python3
+#####################################################################
+#
+# logdecode.py
+#
+#   Decode the flight data recorder from an EEPROM dump of the sensor.
+#   Read the EEPROM with 'make logread' or:
+#     avrdude -P <port> -c dasa -p m328p -U eeprom:r:flightlog.eep:i
+#   and then decode with:
+#     python3 logdecode.py flightlog.eep [--csv]
+#   The record format is described in flight_log.c
+#
+#####################################################################
+
+import sys
+
+LOG_DIR_START = 0
+LOG_DIR_ENTRIES = 8
+LOG_DIR_ENTRY_SIZE = 4
+LOG_RING_START = LOG_DIR_START + LOG_DIR_ENTRIES * LOG_DIR_ENTRY_SIZE
+LOG_DIR_CHECK = 0xa5
+
+LOG_TAG_HEADER = 0xc0
+LOG_TAG_END = 0xff
+LOG_SEQ_MASK = 0x1f
+
+RESET_CAUSES = ['power on', 'external', 'brown-out', 'watchdog']   # Counters at the top of the EEPROM
+
+
+
+def read_ihex(file_name):
+    '''
+    Read an Intel HEX file and return its content as a bytearray.
+    Bytes not in the file read as erased EEPROM (0xff).
+    '''
+    data = bytearray()
+    base = 0
+    with open(file_name) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith(':'):
+                continue
+            record = bytes.fromhex(line[1:])
+            count, address, rtype = record[0], (record[1] << 8) + record[2], record[3]
+            if sum(record) & 0xff:
+                raise ValueError('Checksum error in ' + line)
+            if rtype == 0:
+                address += base
+                if len(data) < address + count:
+                    data.extend([0xff] * (address + count - len(data)))
+                data[address:address + count] = record[4:4 + count]
+            elif rtype == 1:
+                break
+            elif rtype == 2:
+                base = ((record[4] << 8) + record[5]) << 4
+            elif rtype == 4:
+                base = ((record[4] << 8) + record[5]) << 16
+    return data
+
+def signed(value, bits):
+    '''
+    Two's complement value of 'bits' wide field
+    '''
+    if value & (1 << (bits - 1)):
+        return value - (1 << bits)
+    return value
+
+def directory(eeprom):
+    '''
+    Return valid directory entries as a list of (sequence, header address)
+    '''
+    flights = []
+    ring_end = len(eeprom) - len(RESET_CAUSES)
+    for slot in range(LOG_DIR_ENTRIES):
+        entry = eeprom[LOG_DIR_START + slot * LOG_DIR_ENTRY_SIZE:][:LOG_DIR_ENTRY_SIZE]
+        address = entry[0] + (entry[1] << 8)
+        seq = entry[2]
+        if entry[3] != entry[0] ^ entry[1] ^ seq ^ LOG_DIR_CHECK:
+            continue
+        if address < LOG_RING_START or address >= ring_end:
+            continue
+        if eeprom[address] != LOG_TAG_HEADER | seq:
+            continue
+        flights.append((seq, address))
+    return flights
+
+def oldest_first(flights):
+    '''
+    Order flights by sequence number, accounting for sequence wrap
+    '''
+    seqs = [seq for seq, _ in flights]
+    # The oldest flight has no valid predecessor
+    for seq, address in flights:
+        if (seq - 1) & LOG_SEQ_MASK not in seqs:
+            start = seq
+            break
+    else:
+        return flights
+    return sorted(flights, key=lambda f: (f[0] - start) & LOG_SEQ_MASK)
+
+def decode_flight(eeprom, address):
+    '''
+    Decode one flight starting at its header record.
+    Returns header information and a list of samples
+    (seconds, pack voltage, minimum cell voltage, bus errors)
+    '''
+    ring_end = len(eeprom) - len(RESET_CAUSES)
+    ring_size = ring_end - LOG_RING_START
+
+    def byte(offset):
+        a = address + offset
+        while a >= ring_end:
+            a -= ring_size
+        return eeprom[a]
+
+    cells = byte(1)
+    interval = byte(2)
+    scale = byte(3) + (byte(4) << 8)
+    adc = byte(5)
+    volts = lambda value: ((value * scale) >> 8) / 100.0
+    min_cell = lambda value: volts(value) / cells if cells else volts(value)
+
+    samples = [(0, volts(adc), min_cell(adc), 0)]
+    offset = 6
+    time = 0
+    while offset < ring_size:
+        tag = byte(offset)
+        if tag & 0x80 == 0:
+            delta = signed((tag >> 3) & 0x0f, 4)
+            sag = tag & 0x07
+            errors = 0
+            offset += 1
+        elif tag & 0xc0 == 0x80:
+            errors = tag & 0x3f
+            delta = signed(byte(offset + 1), 8)
+            sag = byte(offset + 2)
+            offset += 3
+        else:
+            break
+        adc += delta
+        time += interval
+        samples.append((time, volts(adc), min_cell(adc - sag), errors))
+
+    return cells, interval, samples
+
+def reset_counts(eeprom):
+    '''
+    Return the persisted reset cause counters as a list of (cause, count)
+    '''
+    counters = eeprom[len(eeprom) - len(RESET_CAUSES):]
+    return [(cause, 0 if count == 0xff else count) for cause, count in zip(RESET_CAUSES, counters)]
+
+def main():
+    if len(sys.argv) < 2:
+        print('usage: logdecode.py <eeprom.eep> [--csv]')
+        sys.exit(1)
+
+    eeprom = read_ihex(sys.argv[1])
+    csv = '--csv' in sys.argv
+
+    if not csv:
+        print('Resets: ' + ', '.join('{} {}'.format(*c) for c in reset_counts(eeprom)))
+
+    flights = oldest_first(directory(eeprom))
+    if not flights:
+        print('No flights in log')
+        return
+
+    if csv:
+        print('flight,seconds,pack_v,min_cell_v,errors')
+
+    for seq, address in flights:
+        cells, interval, samples = decode_flight(eeprom, address)
+        if csv:
+            for sample in samples:
+                print('{},{},{:.2f},{:.3f},{}'.format(seq, *sample))
+            continue
+        low = min(samples, key=lambda s: s[2])
+        print('Flight {} at 0x{:03x}: {}S, {} samples every {}s, {}s'.format(
+              seq, address, cells, len(samples), interval, samples[-1][0]))
+        print('  start {:.2f}v  end {:.2f}v  lowest cell {:.3f}v at {}s  bus errors {}'.format(
+              samples[0][1], samples[-1][1], low[2], low[0], sum(s[3] for s in samples)))
+
+if __name__ == '__main__':
+    main()
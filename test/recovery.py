@@ -0,0 +1,138 @@
+#!/usr/bin/python3
+#####################################################################
+#
+# recovery.py
+#
+#   Emulates the RC receiver polling the sensor, disturbs the bus,
+#   and measures the time until the sensor answers again.
+#   Connect the PC to the sensor as in the FlySky receiver emulation
+#   setup, see README.md. Host USB serial latency adds ~1 to 2mSec
+#   to every measurement, compare results on the same host only.
+#
+#   Disturbances:
+#     noise    - burst of random bytes, the sensor loses packet framing
+#     partial  - truncated command packet
+#     break    - serial break, UART frame errors
+#     silence  - receiver stops polling for a while (link loss)
+#
+#   python3 recovery.py [port] [--count N]
+#
+#####################################################################
+
+import random
+import statistics
+import sys
+import time
+
+import serial
+
+from ibus_codec import build_packet, parse_packet, IBUS_CMD_SENSOR_READ
+
+IBUS_SENSOR_ID = 1          # Sensor #1
+POLL_INTERVAL = 0.0077      # Receiver poll interval in seconds
+RECOVERY_LIMIT = 2.0        # Give up after 2 seconds without a response
+
+DISTURBANCES = ['noise', 'partial', 'break', 'silence']
+
+
+
+def valid_response(data, command, sensor_id):
+    '''
+    Check a sensor response for length, command, sensor ID and checksum.
+    '''
+    if len(data) < 4 or data[0] != len(data):
+        return False
+    response_command, response_sensor, checksum_ok = parse_packet(data[0], data[1:])
+    return checksum_ok and response_command == command and response_sensor == sensor_id
+
+def poll(ser):
+    '''
+    Send one sensor read command and wait for the response.
+    Because the receive and transmit lines are linked the
+    command echo is read back first.
+    Returns True if the sensor responded with a valid packet.
+    '''
+    packet = build_packet(IBUS_CMD_SENSOR_READ, IBUS_SENSOR_ID)
+    ser.reset_input_buffer()
+    ser.write(packet)
+    ser.read(len(packet))
+    response = ser.read(6)
+    return valid_response(response, IBUS_CMD_SENSOR_READ, IBUS_SENSOR_ID)
+
+def disturb(ser, kind):
+    '''
+    Disturb the bus.
+    '''
+    if kind == 'noise':
+        ser.write(bytes(random.randrange(256) for _ in range(random.randint(3, 30))))
+    elif kind == 'partial':
+        ser.write(build_packet(IBUS_CMD_SENSOR_READ, IBUS_SENSOR_ID)[:2])
+    elif kind == 'break':
+        ser.send_break(0.005)
+    elif kind == 'silence':
+        time.sleep(random.uniform(0.1, 1.0))
+    ser.flush()
+
+def recovery_time(ser, kind):
+    '''
+    Poll until the sensor answers, disturb the bus, then poll at
+    the receiver rate until it answers again.
+    Returns recovery time in seconds and polls lost, or None on time out.
+    '''
+    start = time.monotonic()
+    while not poll(ser):
+        if time.monotonic() - start > RECOVERY_LIMIT:
+            return None
+        time.sleep(POLL_INTERVAL)
+
+    disturb(ser, kind)
+
+    start = time.monotonic()
+    lost = 0
+    while True:
+        next_poll = time.monotonic() + POLL_INTERVAL
+        if poll(ser):
+            return time.monotonic() - start, lost
+        lost += 1
+        if time.monotonic() - start > RECOVERY_LIMIT:
+            return None
+        time.sleep(max(0, next_poll - time.monotonic()))
+
+def main():
+    port = '/dev/ttyUSB0'
+    count = 20
+    args = sys.argv[1:]
+    if '--count' in args:
+        i = args.index('--count')
+        count = int(args[i + 1])
+        del args[i:i + 2]
+    if args:
+        port = args[0]
+
+    ser = serial.Serial(port, baudrate=115200, write_timeout=0.5, timeout=POLL_INTERVAL)
+    print(ser.name, ser.baudrate, ser.bytesize, ser.parity, ser.stopbits)
+
+    print('{:8s} {:>5s} {:>8s} {:>8s} {:>8s} {:>6s} {:>6s}'.format(
+          'disturb', 'runs', 'min ms', 'mean ms', 'max ms', 'lost', 'fail'))
+
+    for kind in DISTURBANCES:
+        times = []
+        lost = []
+        fail = 0
+        for _ in range(count):
+            result = recovery_time(ser, kind)
+            if result is None:
+                fail += 1
+                continue
+            times.append(result[0] * 1000)
+            lost.append(result[1])
+        if not times:
+            print('{:8s} {:5d} {:>8s} {:>8s} {:>8s} {:>6s} {:6d}'.format(kind, count, '-', '-', '-', '-', fail))
+            continue
+        print('{:8s} {:5d} {:8.1f} {:8.1f} {:8.1f} {:6.1f} {:6d}'.format(
+              kind, count, min(times), statistics.mean(times), max(times), statistics.mean(lost), fail))
+
+    ser.close()
+
+if __name__ == '__main__':
+    main()
@@ -11,39 +11,94 @@
 #include    <avr/io.h>
 #include    <avr/interrupt.h>
 #include    <avr/wdt.h>
+#include    <avr/eeprom.h>
+#include    <avr/sleep.h>
+#include    <util/atomic.h>
 
 #include    "util.h"
+#include    "adc_filter.h"
+#include    "adc_alarm.h"
+#include    "battery.h"
 
 /****************************************************************************
   Types and definitions
 ****************************************************************************/
 
-/* ADC readout averaging parameters.
+/* ADC readout filter parameters.
  * ADC is read at Timer0 rate, with Fclk at 10Mhz the rate
- * is about 38 samples per second. Selecting ADC_AVERAGE_BITS=5
- * will result in averaging 32 samples (approximately 1 second).
+ * is about 38 samples per second. Conversions are requested at Timer0
+ * overflow and run in the next bus gap, see adc_convert().
+ * Selecting ADC_AVERAGE_BITS=5 will result in averaging 32 samples
+ * (approximately 1 second).
+ * Use test/filter_bench.c to compare filter types and lengths
+ * on recorded or synthetic discharge traces.
  */
+#define     ADC_FILTER          ADC_FILTER_BOXCAR       // ADC_FILTER_BOXCAR or ADC_FILTER_EMA
 #define     ADC_AVERAGE_BITS    5                       // 1, 2, 3, 4, or 5
-#define     ADC_AVERAGE_MAX     32
 #define     ADC_AVERAGE         (1<<ADC_AVERAGE_BITS)   // Power of 2 (2, 4, 8, 16, 32)
 #if (ADC_AVERAGE>ADC_AVERAGE_MAX)
 #warning "ADC averaging is out of range. Reduce ADC_AVERAGE_BITS!"
 #endif
 
+#define     ADC_TEMP_PERIOD     (ADC_TEMP_INTERVAL + 2) // ADC scheduler cycle length
+
+/* Timer0 is halted while the ADC converts in noise reduction sleep,
+ * for 13 ADC clocks at Fclk/128. The lost time is added back to the
+ * time base after every conversion.
+ */
+#define     ADC_SLEEP_US        ((13UL * 128UL * 1000000UL) / F_CPU)
+#define     ADC_SLEEP_TICKS     ((13U * 128U) / 8U)     // Timer1 Fosc/8 ticks
+
+#if ( ADC_FILTER == ADC_FILTER_BOXCAR )
+#define     ADC_SETTLE          ADC_AVERAGE             // Samples until filter output is valid
+#else
+#define     ADC_SETTLE          (4*ADC_AVERAGE)
+#endif
+
 /****************************************************************************
   Function prototypes
 ****************************************************************************/
+static inline void adc_read_primary(void);
 
 /****************************************************************************
   Globals
 ****************************************************************************/
-volatile uint16_t   global_counter = 0;     // Global time base
+volatile uint32_t   global_counter = 0;     // Global time base in mSec
 volatile uint16_t   adc = 0;                // Global ADC last value
+volatile uint8_t    adc_request = 0;        // ADC conversion requested by Timer0
+volatile uint8_t    adc_scan_next = 0;      // Another conversion of the scan is due
+#if ( ENABLE_PACK2_SNS )
+volatile uint16_t   adc2 = 0;               // Second pack ADC last value
+uint8_t             adc_next_admux = ADMUX_INIT;   // ADC input after the second pack conversion
+#endif
+uint16_t            adc_sleep_us = 0;       // Time base correction for ADC sleep
+volatile uint16_t   timestamp_halted = 0;   // Timer1 ticks lost in ADC sleep, wraps
+adc_stats_t         adc_stats[ADC_CHANNELS] =   // ADC min/max/sag per voltage channel since power up
+{
+    ADC_STATS_INIT(ADC_SETTLE),
+#if ( ENABLE_PACK2_SNS )
+    ADC_STATS_INIT(ADC_SETTLE),
+#endif
+};
+#if ( ENABLE_TEMP_SNS )
+volatile uint16_t   temperature_acc = 0;    // Temperature 10-bit ADC EMA, scaled by 2^ADC_TEMP_BITS
+#endif
+#if ( ENABLE_ALARM )
+adc_alarm_t         adc_alarm = ADC_ALARM_INIT;     // Low voltage alarm state
+const adc_alarm_level_t alarm_levels[] =            // Alarm levels, ascending cell count
+{
+    { BATT_ADC(2 * ALARM_DETECT_CELL), BATT_ADC(ALARM_2S_ON), BATT_ADC(ALARM_2S_OFF) },
+    { BATT_ADC(3 * ALARM_DETECT_CELL), BATT_ADC(ALARM_3S_ON), BATT_ADC(ALARM_3S_OFF) },
+    { BATT_ADC(4 * ALARM_DETECT_CELL), BATT_ADC(ALARM_4S_ON), BATT_ADC(ALARM_4S_OFF) },
+};
+#define     ALARM_LEVELS        (sizeof(alarm_levels) / sizeof(adc_alarm_level_t))
+#endif
+uint8_t             reset_flags __attribute__((section(".noinit")));  // MCUSR copy, saved before C start up
 
 /* ----------------------------------------------------------------------------
  * reset()
  *
- *  Clear SREG_I on hardware reset.
+ *  Clear SREG_I and disable the watchdog on hardware reset.
  *  source: http://electronics.stackexchange.com/questions/117288/watchdog-timer-issue-avr-atmega324pa
  */
 void reset(void)
@@ -54,6 +109,9 @@ void reset(void)
     // after a system reset (except a power-on condition), using the fastest
     // prescaler value (approximately 15 ms). It is therefore required
     // to turn off the watchdog early during program startup.
+    // The reset flags are saved for reset_count_update(), .noinit
+    // variables are not cleared by the C start up code that follows.
+    reset_flags = MCUSR;
     MCUSR = 0;  // clear reset flags
     wdt_disable();
 }
@@ -76,21 +134,20 @@ void ioinit(void)
     DDRB  = PB_DDR_INIT;
     PORTB = PB_INIT | PB_PUP_INIT;
 
-    /* Timer0
+    /* Timer0, this is the 1mSec time base
      */
     TCNT0 = 0;
+    OCR0A = TMR0_MS_COUNTS - 1;
     TCCR0A = TCCR0A_INIT;
     TCCR0B = TCCR0B_INIT;
     TIMSK0 = TIMSK_INIT;
 
-    /* Timer1, this is the 'gap timer' watchdog
+    /* Timer1, free running time stamp counter
+     * and the 'gap timer' watchdog
      */
-    TCNT1H = 0;
-    TCNT1L = 0;
-    OCR1AH = 0;
-    OCR1AL = OCR1AL_INIT;
+    TCNT1 = 0;
     TCCR1A = TCCR1A_INIT;
-    TCCR1B = (TCCR1B_INIT & TMR1_DIS);
+    TCCR1B = TCCR1B_INIT;
     TCCR1C = TCCR1C_INIT;
     TIMSK1 = TIMSK1_INIT;
 
@@ -113,7 +170,8 @@ void ioinit(void)
 /* ----------------------------------------------------------------------------
  * enable_gap_timer()
  *
- *  Enable the gap timer
+ *  Restart the gap timer, it will expire 1mSec from now.
+ *  Called from the UART receive ISR.
  * 
  *  param:  none
  *  return: none
@@ -121,9 +179,9 @@ void ioinit(void)
  */
 void enable_gap_timer(void)
 {
-    TCNT1H = 0;
-    TCNT1L = 0;
-    TCCR1B |= TMR1_ENA;
+    OCR1A = TCNT1 + TMR1_GAP_TICKS;
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
 }
 
 /* ----------------------------------------------------------------------------
@@ -137,7 +195,7 @@ void enable_gap_timer(void)
  */
 void disable_gap_timer(void)
 {
-    TCCR1B &= TMR1_DIS;
+    TIMSK1 &= ~_BV(OCIE1A);
 }
 
 /* ----------------------------------------------------------------------------
@@ -182,6 +240,78 @@ void status_led_swap(void)
     PORTB ^= STATUS_LED;
 }
 
+/* ----------------------------------------------------------------------------
+ * adc_conversion_due()
+ *
+ *  Check if an ADC conversion was requested by Timer0
+ *
+ *  param:  none
+ *  return: '1'=conversion due, '0'=no conversion due
+ *
+ */
+int adc_conversion_due(void)
+{
+    return adc_request;
+}
+
+/* ----------------------------------------------------------------------------
+ * adc_convert()
+ *
+ *  Run an ADC scan with the CPU in ADC noise reduction sleep mode.
+ *  The conversion starts when the sleep mode is entered, and the ADC
+ *  interrupt wakes the CPU when it completes, ~170uSec at 10MHz.
+ *  With the second pack channel enabled the ADC interrupt requests a
+ *  second conversion, and the scan takes ~340uSec.
+ *  The I/O clock is stopped during the conversion so UART receive and
+ *  the timers are halted, and a byte arriving during the scan is lost.
+ *  Call this function only in a bus gap with the whole scan time left
+ *  before the next poll, as task_adc() does through the scheduler's poll
+ *  gating, see sched_dispatch(). The bus idle check alone is not enough,
+ *  a poll can start right after it.
+ *  The halted time is added back to the mSec time base.
+ *  Call with interrupts disabled, after checking that the bus is idle,
+ *  so the gap cannot end between the check and the sleep instruction.
+ *  The function returns with interrupts enabled.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void adc_convert(void)
+{
+    adc_request = 0;
+
+    set_sleep_mode(SLEEP_MODE_ADC);
+    sleep_enable();
+
+    do
+    {
+        adc_scan_next = 0;
+
+        do
+        {
+            sei();          // The instruction after 'sei' is executed before any interrupt
+            sleep_cpu();
+            cli();
+        }
+        while ( ADCSRA & _BV(ADSC) );
+
+        /* Add the time Timer0 was halted to the time base
+         */
+        timestamp_halted += ADC_SLEEP_TICKS;
+        adc_sleep_us += ADC_SLEEP_US;
+        if ( adc_sleep_us >= 1000 )
+        {
+            adc_sleep_us -= 1000;
+            global_counter++;
+        }
+    }
+    while ( adc_scan_next );
+
+    sleep_disable();
+    sei();
+}
+
 /* ----------------------------------------------------------------------------
  * get_adc()
  *
@@ -196,60 +326,371 @@ uint16_t get_adc(void)
     return adc;
 }
 
+/* ----------------------------------------------------------------------------
+ * get_adc2()
+ *
+ *  Return the value of the last second pack ADC conversion
+ *
+ *  param:  none
+ *  return: ADC value, or 0 if the channel is not enabled
+ *
+ */
+uint16_t get_adc2(void)
+{
+#if ( ENABLE_PACK2_SNS )
+    return adc2;
+#else
+    return 0;
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ * get_adc_stats()
+ *
+ *  Return a copy of the filtered ADC statistics of a voltage channel
+ *
+ *  param:  channel ADC_CHANNEL_PACK or ADC_CHANNEL_PACK2, pointer to statistics structure
+ *  return: none
+ *
+ */
+void get_adc_stats(uint8_t channel, adc_stats_t *stats)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *stats = adc_stats[channel];
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * get_temperature()
+ *
+ *  Return the internal temperature sensor reading
+ *
+ *  param:  none
+ *  return: temperature in 0.1'C units, where 0=-40'C, or 0 if not available
+ *
+ */
+uint16_t get_temperature(void)
+{
+#if ( ENABLE_TEMP_SNS )
+    uint16_t    reading;
+    int32_t     temperature;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        reading = temperature_acc;
+    }
+
+    if ( reading == 0 )
+    {
+        return 0;
+    }
+
+    temperature = (int32_t)((reading >> ADC_TEMP_BITS) - TEMP_ADC_25C) * TEMP_SCALE / 100;
+    temperature += 650;     // 25'C + 40'C offset in 0.1'C units
+
+    return (temperature < 0) ? 0 : (uint16_t) temperature;
+#else
+    return 0;
+#endif
+}
+
 /* ----------------------------------------------------------------------------
  * get_global_time()
  *
- *  Return the value of the global timer tick counter
+ *  Return the value of the global mSec time base.
+ *  The 32-bit time wraps around every ~49.7 days.
+ *
+ *  param:  none
+ *  return: time in mSec since power up
+ *
+ */
+uint32_t get_global_time(void)
+{
+    uint32_t    time;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        time = global_counter;
+    }
+
+    return time;
+}
+
+/* ----------------------------------------------------------------------------
+ * get_timestamp()
+ *
+ *  Return a time stamp from the free running Timer1.
+ *  The time stamp wraps around every ~52mSec at 10MHz, use it for
+ *  short intervals: TIMESTAMP_TO_US(get_timestamp() - start)
+ *  Timer1 is halted during ADC noise reduction sleep.
  *
  *  param:  none
- *  return: counter value
+ *  return: Timer1 count, 8 system clocks per count
  *
  */
-uint16_t get_global_time(void)
+uint16_t get_timestamp(void)
 {
-    return global_counter;
+    uint16_t    timestamp;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        timestamp = TCNT1;
+    }
+
+    return timestamp;
 }
 
 /* ----------------------------------------------------------------------------
- * This ISR will trigger when ADC0 analog to digital conversion is complete.
- * The ISR implements a moving average calculation over the ADC readouts
- * using a circular buffer algorithm.
+ * get_timestamp_halted()
+ *
+ *  Return the Timer1 ticks lost while the ADC converted in noise
+ *  reduction sleep. Add the difference over an interval to the time
+ *  stamp difference to measure the elapsed time of code that may
+ *  run ADC conversions.
+ *  Updated by adc_convert() with interrupts disabled, so it can be
+ *  read from the main loop and from interrupts.
+ *
+ *  param:  none
+ *  return: halted Timer1 ticks since power up, wraps around
+ *
+ */
+uint16_t get_timestamp_halted(void)
+{
+    return timestamp_halted;
+}
+
+/* ----------------------------------------------------------------------------
+ * reset_count_update()
+ *
+ *  Count the cause of the last reset in its EEPROM counter.
+ *  Power on takes precedence, the brown-out flag is also set on power up.
+ *  Blocks for one EEPROM write, call once on start up.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+void reset_count_update(void)
+{
+    uint8_t     cause, count;
+    uint8_t    *address;
+
+    if ( reset_flags & _BV(PORF) )
+    {
+        cause = RESET_CAUSE_POWER;
+    }
+    else if ( reset_flags & _BV(WDRF) )
+    {
+        cause = RESET_CAUSE_WDT;
+    }
+    else if ( reset_flags & _BV(BORF) )
+    {
+        cause = RESET_CAUSE_BROWN;
+    }
+    else if ( reset_flags & _BV(EXTRF) )
+    {
+        cause = RESET_CAUSE_EXT;
+    }
+    else
+    {
+        return;
+    }
+
+    address = (uint8_t *)(RESET_COUNT_START + cause);
+    count = get_reset_count(cause);
+
+    if ( count < RESET_COUNT_MAX )
+    {
+        eeprom_write_byte(address, count + 1);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * get_reset_count()
+ *
+ *  Read a persisted reset cause counter.
+ *
+ *  param:  RESET_CAUSE_* reset cause
+ *  return: reset count, saturates at RESET_COUNT_MAX
+ *
+ */
+uint8_t get_reset_count(uint8_t cause)
+{
+    uint8_t     count;
+
+    count = eeprom_read_byte((uint8_t *)(RESET_COUNT_START + cause));
+
+    return (count == 0xff) ? 0 : count;
+}
+
+/* ----------------------------------------------------------------------------
+ * adc_read_primary()
+ *
+ *  Handle the first conversion of an ADC scan, the pack voltage on ADC0
+ *  or a temperature sensor slot. Filters the ADC readouts with the filter
+ *  selected by ADC_FILTER, tracks the filtered value statistics, and
+ *  drives the low voltage alarm output once the filter settled.
+ *  With the temperature sensor enabled this also schedules the ADC
+ *  input. ADMUX changes take effect at the start of the next conversion,
+ *  so the input for conversion n+1 is selected when conversion n completes.
+ *  Called from the ADC ISR.
+ *
+ *  param:  none
+ *  return: none
+ *
+ */
+static inline void adc_read_primary(void)
+{
+#if ( ENABLE_TEMP_SNS )
+    static uint8_t  adc_sequence = 0;
+    uint8_t         adc_slot;
+    uint16_t        reading;
+
+    adc_slot = adc_sequence++;
+    if ( adc_sequence == ADC_TEMP_PERIOD )
+    {
+        adc_sequence = 0;
+    }
+
+    if ( adc_slot == (ADC_TEMP_INTERVAL - 1) )
+    {
+        /* Last voltage conversion, next is temperature
+         */
+        ADMUX = ADMUX_TEMP;
+    }
+    else if ( adc_slot == ADC_TEMP_INTERVAL )
+    {
+        /* Discard first conversion of the temperature sensor
+         */
+        return;
+    }
+    else if ( adc_slot == (ADC_TEMP_INTERVAL + 1) )
+    {
+        reading = (ADC >> 6);
+        ADMUX = ADMUX_INIT;
+
+        if ( temperature_acc == 0 )
+        {
+            temperature_acc = (reading << ADC_TEMP_BITS);
+        }
+        else
+        {
+            temperature_acc -= (temperature_acc >> ADC_TEMP_BITS);
+            temperature_acc += reading;
+        }
+
+        return;
+    }
+#endif
+
+#if ( ADC_FILTER == ADC_FILTER_BOXCAR )
+    static adc_boxcar_t adc_filter;
+
+    adc = adc_boxcar_update(&adc_filter, ADCH, ADC_AVERAGE_BITS);
+#else
+    static adc_ema_t    adc_filter;
+
+    adc = adc_ema_update(&adc_filter, ADCH, ADC_AVERAGE_BITS);
+#endif
+
+    adc_stats_update(&adc_stats[ADC_CHANNEL_PACK], (uint8_t) adc);
+
+#if ( ENABLE_ALARM )
+    if ( adc_stats[ADC_CHANNEL_PACK].settle == 0 )
+    {
+        if ( adc_alarm_update(&adc_alarm, alarm_levels, ALARM_LEVELS, (uint8_t) adc) )
+        {
+            PORTB |= ALARM_OUT;
+        }
+        else
+        {
+            PORTB &= ~ALARM_OUT;
+        }
+    }
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ * This ISR will trigger when an analog to digital conversion is complete.
+ * With the second pack channel enabled every conversion with the external
+ * reference is followed by an ADC1 conversion in the same scan, and the
+ * input selected for the next scan is restored after it.
  *
  */
 ISR(ADC_vect)
 {
-    uint8_t         adc_readout;
+#if ( ENABLE_PACK2_SNS )
+    uint8_t     admux;
+
+    admux = ADMUX;
+
+    if ( admux == ADMUX_PACK2 )
+    {
+#if ( ADC_FILTER == ADC_FILTER_BOXCAR )
+        static adc_boxcar_t adc2_filter;
 
-    static uint16_t adc_values[ADC_AVERAGE_MAX] =
-            { 0,0,0,0,0,0,0,0,0,0,
-              0,0,0,0,0,0,0,0,0,0,
-              0,0,0,0,0,0,0,0,0,0,
-              0,0 };
-    static uint8_t  adc_in = (ADC_AVERAGE - 1);
-    static uint8_t  adc_out = 0;
-    static uint16_t adc_sum = 0;
+        adc2 = adc_boxcar_update(&adc2_filter, ADCH, ADC_AVERAGE_BITS);
+#else
+        static adc_ema_t    adc2_filter;
 
-    adc_readout = ADCH;
+        adc2 = adc_ema_update(&adc2_filter, ADCH, ADC_AVERAGE_BITS);
+#endif
+
+        adc_stats_update(&adc_stats[ADC_CHANNEL_PACK2], (uint8_t) adc2);
 
-    adc_sum -= adc_values[adc_out];
-    adc_out++;
-    adc_out &= (ADC_AVERAGE - 1);
+        ADMUX = adc_next_admux;
+        return;
+    }
+#endif
 
-    adc_in++;
-    adc_in &= (ADC_AVERAGE - 1);
-    adc_values[adc_in] = adc_readout;
-    adc_sum += adc_readout;
+    adc_read_primary();
 
-    adc = (adc_sum >> ADC_AVERAGE_BITS);
+#if ( ENABLE_PACK2_SNS )
+    if ( admux == ADMUX_INIT )
+    {
+        adc_next_admux = ADMUX;
+        ADMUX = ADMUX_PACK2;
+        adc_scan_next = 1;
+    }
+#endif
 }
 
 /* ----------------------------------------------------------------------------
- * This ISR will trigger approximately every 26mSec when Timer0 overflows, @ 10MHz clock.
- * The ISR increments a global 16-bit time variable that will overflow (cycle back through 0)
- * approximately every 28.6 minutes.
+ * This ISR will trigger every 1mSec on Timer0 compare match.
+ * The ISR increments the global 32-bit mSec time base and requests
+ * an ADC conversion every ADC_INTERVAL_MS.
+ * The compare value is stretched by one count whenever the accumulated
+ * fraction of a count overflows, so the average period is exactly 1mSec.
+ * OCR0A is not double buffered in CTC mode, the new value applies to the
+ * period that just started.
  *
  */
-ISR(TIMER0_OVF_vect)
+ISR(TIMER0_COMPA_vect)
 {
+    static uint8_t  adc_interval = 0;
+#if ( TMR0_MS_FRACT )
+    static uint16_t fraction = 0;
+
+    /* Compared before adding, fraction + TMR0_MS_FRACT can exceed 16 bits
+     */
+    if ( fraction >= (64000U - TMR0_MS_FRACT) )
+    {
+        fraction -= (64000U - TMR0_MS_FRACT);
+        OCR0A = TMR0_MS_COUNTS;
+    }
+    else
+    {
+        fraction += TMR0_MS_FRACT;
+        OCR0A = TMR0_MS_COUNTS - 1;
+    }
+#endif
+
     global_counter++;
+
+    if ( ++adc_interval == ADC_INTERVAL_MS )
+    {
+        adc_interval = 0;
+        adc_request = 1;
+    }
 }
@@ -11,16 +11,17 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
+#include    "board.h"
+#include    "adc_filter.h"
+#include    "battery.h"
+
 /****************************************************************************
   Definitions
 ****************************************************************************/
-// IO port B initialization
-#define     PB_DDR_INIT     0b00101001  // Port data direction
+// IO port B initialization, pins per MCU in board.h
+#define     PB_DDR_INIT     (STATUS_LED | PB_ISP_OUT | (ENABLE_ALARM ? ALARM_OUT : 0))  // Port data direction
 #define     PB_PUP_INIT     0b00000000  // Port input pin pull-up
-#define     PB_INIT         0b00000001  // Port initial values
-
-#define     STATUS_LED      0b00000001
-#define     CALIBRATION     0b00000010
+#define     PB_INIT         STATUS_LED  // Port initial values
 
 /* IO port C initialization
  */
@@ -35,66 +36,146 @@
 #define     PD_INIT         0b00000010  // Port initial values
 
 /* Timer0 initialization
- * Using Timer0 for time-out measurements
- * Divide system clock by 1,024, and Timer0 Mode-0 by 256
- * for overflow interrupt interval
+ * Using Timer0 for the 1mSec time base.
+ * Divide system clock by 64, and Timer0 CTC mode by ~156 at 10MHz,
+ * see TMR0_MS_COUNTS in board.h
  */
-#define     TCCR0A_INIT     0b00000000  // Normal mode, no compare match
-#define     TCCR0B_INIT     0b00000101  // Mode-0 timer, Clk/1024
-#define     TIMSK_INIT      0b00000001  // Enable Timer0 overflow interrupt
-
-#if (F_CPU == 8000000UL)
-#define     RATE_1HZ        30          // Equivalent timer ticks
-#define     RATE_2HZ        15
-#define     RATE_4HZ        7
-#elif (F_CPU == 10000000UL)
-#define     RATE_1HZ        38          // Equivalent timer ticks
-#define     RATE_2HZ        19
-#define     RATE_4HZ        9
-#elif (F_CPU == 16000000UL)
-#define     RATE_1HZ        61          // Equivalent timer ticks
-#define     RATE_2HZ        30
-#define     RATE_4HZ        15
-#else
-#warning "Device clock not defined"
-#endif
+#define     TCCR0A_INIT     0b00000010  // CTC mode, top is OCR0A
+#define     TCCR0B_INIT     0b00000011  // Clk/64
+#define     TIMSK_INIT      0b00000010  // Enable Timer0 compare A interrupt
+
+#define     RATE_1HZ        1000        // Equivalent timer ticks
+#define     RATE_2HZ        500
+#define     RATE_4HZ        250
+
+#define     ADC_INTERVAL_MS 26          // ADC conversion request interval, ~38Hz
 
 /* Timer1 initialization
+ * Free running at Fosc/8, 0.8uSec per tick at 10MHz, wraps every ~52mSec.
+ * Compare A is the 'gap timer', armed 1mSec ahead on every received byte.
  */
-#define     OCR1AL_INIT     156;        // 1mSec time out.
-#define     TCCR1A_INIT     0b00000000  // Set timer top with OCR1A
-#define     TCCR1B_INIT     0b00001011  // Fosc 1/64
+#define     TCCR1A_INIT     0b00000000  // Normal mode
+#define     TCCR1B_INIT     0b00000010  // Fosc 1/8
 #define     TCCR1C_INIT     0b00000000
-#define     TIMSK1_INIT     0b00000010
+#define     TIMSK1_INIT     0b00000000  // Compare A interrupt enabled by enable_gap_timer()
 
-#define     TMR1_DIS        0b11111000  // AND with TCCR1B
-#define     TMR1_ENA        0b00000011  // OR with TCCR1B to enable timer at Fosc 1/64
+/* UART BAUD rates, UBRR0 values for U2X0 set
+ */
+#define     BAUD_19200      UART_UBRR(19200UL)
+#define     BAUD_38400      UART_UBRR(38400UL)
+#define     BAUD_115200     UART_UBRR(115200UL)
 
-/* UART BAUD rates
+/* Second pack voltage channel
+ * A second battery, for example a receiver or ignition pack, on ADC1
+ * with its own divider (BATT2_DIVIDER in battery.h). Both channels are
+ * converted back to back in the same bus gap, ADC0 then ADC1, so both
+ * are sampled at the full ~38Hz rate, and the ADC keeps the CPU asleep
+ * for ~340uSec per gap instead of ~170uSec.
+ * Keep the divider source impedance low or add a 100nF capacitor on the
+ * ADC1 input, the channel is sampled right after the input multiplexer
+ * switched.
  */
-#if (F_CPU == 8000000UL)
-#define     UART_BAUD_19200     51  // UBRR0 values for 8MHz clock and U2X0 set
-#define     UART_BAUD_115200    8
-#elif (F_CPU == 10000000UL)
-#define     UART_BAUD_19200     64  // UBRR0 values for 10MHz clock and U2X0 set
-#define     UART_BAUD_115200    10
-#elif (F_CPU == 16000000UL)
-#define     UART_BAUD_19200     103 // UBRR0 values for 16MHz clock and U2X0 set
-#define     UART_BAUD_115200    16
+#define     ENABLE_PACK2_SNS    0       // Set to non-zero to enable the second pack voltage channel
+
+#define     ADC_CHANNEL_PACK    0       // Voltage channels, index of get_adc_stats()
+#define     ADC_CHANNEL_PACK2   1
+#if ( ENABLE_PACK2_SNS )
+#define     ADC_CHANNELS        2
 #else
-#warning "Device clock not defined"
+#define     ADC_CHANNELS        1
 #endif
 
-#define     BAUD_19200      UART_BAUD_19200
-#define     BAUD_38400      UART_BAUD_38400
-#define     BAUD_115200     UART_BAUD_115200
-
 /* ADC converter
+ * The reference is external on AREF, or the internal 1.1v reference
+ * with ADC_REF_INTERNAL set in battery.h.
+ */
+#if ( ADC_REF_INTERNAL )
+#define     ADMUX_REF       ADMUX_REF_1V1
+#else
+#define     ADMUX_REF       0b00000000  // External reference on AREF
+#endif
+#define     ADMUX_INIT      (ADMUX_REF | 0b00100000)    // Left adjusted result, ADC0 source
+#define     ADMUX_TEMP      (ADMUX_REF | 0b00101000)    // Left adjusted result, temperature sensor source
+#define     ADMUX_PACK2     (ADMUX_REF | 0b00100001)    // Left adjusted result, ADC1 source
+#define     ADCSRA_INIT     0b10001111  // Single conversion started by ADC noise reduction sleep, Fclk/128
+#define     ADCSRB_INIT     0b00000000  // No auto trigger, conversions requested by Timer0 every ADC_INTERVAL_MS
+#if ( ENABLE_PACK2_SNS )
+#define     DIDR0_INIT      0b00000011  // disable digital input on ADC0 and ADC1
+#else
+#define     DIDR0_INIT      0b00000001  // disable digital input on ADC0
+#endif
+
+/* Internal temperature sensor
+ * The ADC scheduler converts the temperature sensor after every ADC_TEMP_INTERVAL
+ * battery voltage conversions. The sensor is only read with the internal
+ * 1.1v reference, so the voltage channels use it too (ADC_REF_INTERNAL in
+ * battery.h) and the reference is never switched. The first conversion
+ * after selecting the sensor is discarded, so the temperature takes 2 of
+ * every (ADC_TEMP_INTERVAL + 2) conversions: with ADC_TEMP_INTERVAL=61 the
+ * voltage sample rate drops by 3.2% to ~37Hz, and the temperature updates
+ * every ~1.6 seconds.
+ */
+#define     ENABLE_TEMP_SNS     0       // Set to non-zero to enable the temperature sensor
+#if ( ENABLE_TEMP_SNS && !HAS_TEMP_SENSOR )
+#error "MCU has no internal temperature sensor"
+#endif
+#if ( ENABLE_TEMP_SNS && !ADC_REF_INTERNAL )
+#error "Temperature sensor needs the internal ADC reference, set ADC_REF_INTERNAL in battery.h"
+#endif
+#define     ADC_TEMP_INTERVAL   61      // Voltage conversions between temperature conversions
+#define     ADC_TEMP_BITS       3       // Temperature EMA filter length 2^bits
+#define     TEMP_ADC_25C        292     // 10-bit ADC at 25'C (314mV typical), calibrate per device
+#define     TEMP_SCALE          976     // 0.001'C per ADC LSB (1.074mV per LSB, 1.1mV per 'C typical)
+
+/* Low voltage alarm
+ * A buzzer or LED on PB2 (active high, drive a buzzer through a transistor)
+ * warns of a low pack locally, without the receiver link. The alarm is
+ * evaluated in the ADC ISR on every filtered voltage value once the filter
+ * settled, it adds a few cycles to the conversion already in the bus gap
+ * and does not delay responses.
+ * The pack's cell count is detected from the first settled value, a pack
+ * of ALARM_DETECT_CELL per cell or more counts as the next larger size.
+ * Detection only moves up, so a fully charged pack of one cell less,
+ * ALARM_CELL_FULL per cell for HV LiPo, must stay below the next size's
+ * detection voltage even with the ADC reference reading
+ * ALARM_REF_TOLERANCE percent off, checked below. At 3.5v per cell a 3S HV
+ * pack (13.05v) reads at most 13.70v with a 5% reference error, below the
+ * 4S detection at 14.00v. A pack connected below 3.5v per cell is already
+ * at the alarm level and may be taken for one cell less, connect charged
+ * packs. The alarm turns on at
+ * or below the ALARM_xS_ON voltage and off at or above ALARM_xS_OFF, the
+ * difference is the hysteresis. Keep it at least two ADC steps, ~0.15v.
+ * The thresholds are evaluated on the ~1 second filter average, load
+ * spikes do not trigger the alarm.
+ */
+#define     ENABLE_ALARM        0       // Set to non-zero to enable the low voltage alarm output
+#define     ALARM_DETECT_CELL   350     // Cell count detection, 0.01v per cell
+#define     ALARM_CELL_FULL     435     // Fully charged HV LiPo cell, 0.01v
+#define     ALARM_REF_TOLERANCE 5       // ADC reference tolerance, percent, trimmed for the internal reference
+#define     ALARM_2S_ON         700     // Alarm thresholds, 0.01v per pack
+#define     ALARM_2S_OFF        720
+#define     ALARM_3S_ON         1050
+#define     ALARM_3S_OFF        1080
+#define     ALARM_4S_ON         1400
+#define     ALARM_4S_OFF        1440
+
+#if ( ENABLE_ALARM && \
+      ((ALARM_DETECT_CELL * 3 * 100) <= (ALARM_CELL_FULL * 2 * (100 + ALARM_REF_TOLERANCE)) || \
+       (ALARM_DETECT_CELL * 4 * 100) <= (ALARM_CELL_FULL * 3 * (100 + ALARM_REF_TOLERANCE))) )
+#error "ALARM_DETECT_CELL can take a charged pack for the next larger size"
+#endif
+
+/* Reset cause counters, persisted at the top of the EEPROM
+ * above the flight log ring buffer. One saturating byte per cause,
+ * an erased cell (0xff) reads as zero.
  */
-#define     ADMUX_INIT      0b00100000; // External reference, left adjusted result, ADC0 source
-#define     ADCSRA_INIT     0b11101111; // Auto trigger, Fclk/128
-#define     ADCSRB_INIT     0b00000100; // Timer/Counter0 Overflow trigger source ~38Hz
-#define     DIDR0_INIT      0b00000001; // disable digital input on ADC0
+#define     RESET_CAUSE_POWER   0       // Power on
+#define     RESET_CAUSE_EXT     1       // External reset pin
+#define     RESET_CAUSE_BROWN   2       // Brown-out
+#define     RESET_CAUSE_WDT     3       // Watchdog
+#define     RESET_CAUSES        4
+#define     RESET_COUNT_START   (E2END + 1 - RESET_CAUSES)
+#define     RESET_COUNT_MAX     254
 
 /****************************************************************************
   Function prototypes
@@ -106,7 +187,16 @@ void     disable_gap_timer(void);
 void     status_led_on(void);
 void     status_led_off(void);
 void     status_led_swap(void);
+int      adc_conversion_due(void);
+void     adc_convert(void);
 uint16_t get_adc(void);
-uint16_t get_global_time(void);
+uint16_t get_adc2(void);
+void     get_adc_stats(uint8_t channel, adc_stats_t *stats);
+uint16_t get_temperature(void);
+uint32_t get_global_time(void);
+uint16_t get_timestamp(void);
+uint16_t get_timestamp_halted(void);
+void     reset_count_update(void);
+uint8_t  get_reset_count(uint8_t cause);
 
 #endif /* __UTIL_H__ */